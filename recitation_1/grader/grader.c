@@ -0,0 +1,653 @@
+/*******************************************************************************
+ * Name        : grader.c
+ * Description : A native version of grade.sh that grades submissions in
+ *               parallel. It unzips the archive of student submissions, and
+ *               for each student zip file creates a "last_first" folder,
+ *               unzips the submission there and runs the test script with its
+ *               output collected in grade.txt, just like grade.sh. Up to -j
+ *               submissions are graded at the same time, each one in its own
+ *               folder and process group, with resource limits and a
+ *               wall-clock timeout. A summary of the durations is printed at
+ *               the end.
+ *               Results are cached by the SHA-256 of the submission zip and
+ *               of the test script, so submissions that have not changed
+ *               since they were last graded by the same test script get
+ *               their old grade.txt back without being unzipped or run.
+ ******************************************************************************/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <glob.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "sha256.h"
+
+#define DEFAULT_ARCHIVE     "gcd_assignments.zip"
+#define DEFAULT_TEST_SCRIPT "test_gcd.sh"
+#define DEFAULT_CACHE_DIR   ".grade_cache"
+#define DEFAULT_TIMEOUT     60      /* seconds of wall-clock time per student */
+#define DEFAULT_MEMORY      1024    /* MiB of address space per student */
+#define MAX_FILE_SIZE       (64L << 20)
+#define MAX_OPEN_FILES      256
+#define SLOWEST_SHOWN       5
+
+typedef enum { PENDING, RUNNING, DONE, FAILED, TIMED_OUT, CACHED } JobState;
+
+typedef struct Job {
+    char *zip;           /* the student's zip file, e.g. hw1_lee_jae.zip */
+    char *dirname;       /* last_first */
+    struct Job *after;   /* earlier job with the same dirname, or NULL */
+    bool live;           /* forked and not reaped yet */
+    char *cache_path;    /* where this result is cached, or NULL */
+    pid_t pid;           /* also the process group of the job */
+    JobState state;
+    int status;          /* from waitpid() */
+    struct timespec start;
+    double seconds;
+} Job;
+
+static struct {
+    char *archive;
+    char *test_script;
+    char *cache_dir;     /* NULL when caching is off */
+    int jobs;
+    int timeout;
+    long memory_mb;
+    bool verbose;
+} opts;
+
+double elapsed_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Runs argv[0] with the given arguments and waits for it. Returns the exit
+ * status, or -1 if it could not be run or did not exit normally.
+ */
+int run_command(char *const argv[]) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        fprintf(stderr, "Error: Cannot execute '%s'. %s.\n", argv[0],
+                strerror(errno));
+        _exit(127);
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/**
+ * Copies the file src to dst. Returns 0 on success and -1 on error.
+ */
+int copy_file(const char *src, const char *dst) {
+    int in = open(src, O_RDONLY), out = -1, result = -1;
+    if (in < 0) {
+        return -1;
+    }
+    if ((out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        goto CLEANUP;
+    }
+    char buf[16384];
+    ssize_t n;
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+        if (write(out, buf, n) != n) {
+            goto CLEANUP;
+        }
+    }
+    result = n < 0 ? -1 : 0;
+CLEANUP:
+    close(in);
+    if (out >= 0 && close(out) < 0) {
+        result = -1;
+    }
+    return result;
+}
+
+/**
+ * Parses the first and last names out of a submission zip file named like
+ * "hw1_last_first.zip" (the second and third '_'-separated fields, as in
+ * grade.sh) and returns a newly allocated "last_first" string.
+ */
+char *make_dirname(const char *zip) {
+    char *base = strdup(zip);
+    char *dot = strrchr(base, '.');
+    if (dot != NULL) {
+        *dot = '\0';
+    }
+    char *fields[3] = { "", "", "" }, *field = base;
+    for (int i = 0; i < 3; i++) {
+        /* Like cut, empty fields count and missing fields are empty. */
+        char *sep = field ? strchr(field, '_') : NULL;
+        if (sep != NULL) {
+            *sep = '\0';
+        }
+        if (field != NULL) {
+            fields[i] = field;
+        }
+        field = sep ? sep + 1 : NULL;
+    }
+    char *dirname;
+    if (asprintf(&dirname, "%s_%s", fields[1], fields[2]) < 0) {
+        dirname = NULL;
+    }
+    free(base);
+    return dirname;
+}
+
+/**
+ * Looks for a cached grade.txt for the job, keyed by the hashes of its zip
+ * file and of the test script. On a hit, the job's folder gets the cached
+ * grade.txt, the zip is deleted as if it had been unzipped, and true is
+ * returned. On a miss, job->cache_path is set so finish_job() can store the
+ * new result.
+ */
+bool restore_cached(Job *job, const char *script_hash) {
+    char zip_hash[SHA256_HEX_SIZE];
+    if (sha256_file(job->zip, zip_hash) < 0 ||
+        asprintf(&job->cache_path, "%s/%s-%s.txt", opts.cache_dir, zip_hash,
+                 script_hash) < 0) {
+        job->cache_path = NULL;
+        return false;
+    }
+    if (access(job->cache_path, R_OK) < 0) {
+        return false;
+    }
+
+    char *dst;
+    if ((mkdir(job->dirname, 0755) < 0 && errno != EEXIST) ||
+        asprintf(&dst, "%s/grade.txt", job->dirname) < 0) {
+        return false;
+    }
+    int result = copy_file(job->cache_path, dst);
+    free(dst);
+    if (result < 0) {
+        return false;
+    }
+    unlink(job->zip);
+    return true;
+}
+
+/**
+ * Copies the job's grade.txt into the cache. The copy goes to a temporary
+ * file first so a concurrent or interrupted run never sees half a result.
+ */
+void store_cached(Job *job) {
+    char *src = NULL, *tmp = NULL;
+    if (asprintf(&src, "%s/grade.txt", job->dirname) >= 0 &&
+        asprintf(&tmp, "%s.%d.tmp", job->cache_path, (int)getpid()) >= 0) {
+        if (copy_file(src, tmp) < 0 || rename(tmp, job->cache_path) < 0) {
+            fprintf(stderr, "Warning: Cannot cache the result of '%s'. %s.\n",
+                    job->dirname, strerror(errno));
+            unlink(tmp);
+        }
+    }
+    free(src);
+    free(tmp);
+}
+
+void set_limit(int resource, rlim_t value) {
+    struct rlimit rl = { value, value };
+    if (setrlimit(resource, &rl) < 0) {
+        perror("setrlimit");
+    }
+}
+
+/**
+ * Body of a job's child process: unzips the submission in its own folder,
+ * then runs the test script under resource limits with its standard output
+ * going to grade.txt. Never returns.
+ */
+void run_job(Job *job) {
+    setpgid(0, 0);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    if (chdir(job->dirname) < 0) {
+        fprintf(stderr, "Error: Cannot enter '%s'. %s.\n", job->dirname,
+                strerror(errno));
+        _exit(126);
+    }
+
+    int null_fd = open("/dev/null", O_RDWR);
+    int err_fd = open("errors.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+    }
+    if (err_fd >= 0) {
+        dup2(err_fd, STDERR_FILENO);
+    }
+
+    char *unzip[] = { "unzip", "-o", "-q", job->zip, NULL };
+    if (run_command(unzip) != 0) {
+        fprintf(stderr, "Error: Cannot unzip '%s'.\n", job->zip);
+    }
+    unlink(job->zip);
+
+    int out_fd = open("grade.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        fprintf(stderr, "Error: Cannot create grade.txt. %s.\n",
+                strerror(errno));
+        _exit(126);
+    }
+    dup2(out_fd, STDOUT_FILENO);
+
+    /* The CPU limit backs up the wall-clock timeout enforced by the parent. */
+    set_limit(RLIMIT_CPU, opts.timeout);
+    set_limit(RLIMIT_AS, (rlim_t)opts.memory_mb << 20);
+    set_limit(RLIMIT_FSIZE, MAX_FILE_SIZE);
+    set_limit(RLIMIT_NOFILE, MAX_OPEN_FILES);
+    set_limit(RLIMIT_CORE, 0);
+
+    char *test[] = { "bash", opts.test_script, NULL };
+    execvp(test[0], test);
+    fprintf(stderr, "Error: Cannot execute bash. %s.\n", strerror(errno));
+    _exit(127);
+}
+
+void print_file(const char *dir, const char *name);
+
+/**
+ * Sets up the student's folder the way grade.sh does and forks the job,
+ * unless the result is already in the cache.
+ */
+void start_job(Job *job, const char *script_hash) {
+    printf("Processing %s.\n", job->zip);
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+
+    if (opts.cache_dir != NULL && restore_cached(job, script_hash)) {
+        job->state = CACHED;
+        if (opts.verbose) {
+            print_file(job->dirname, "grade.txt");
+        }
+        printf("%s: restored from cache.\n", job->dirname);
+        return;
+    }
+
+    char *dst = NULL;
+    if ((mkdir(job->dirname, 0755) < 0 && errno != EEXIST) ||
+        asprintf(&dst, "%s/%s", job->dirname, job->zip) < 0 ||
+        rename(job->zip, dst) < 0) {
+        fprintf(stderr, "Error: Cannot move '%s' into '%s'. %s.\n",
+                job->zip, job->dirname, strerror(errno));
+        free(dst);
+        job->state = FAILED;
+        return;
+    }
+    free(dst);
+    if (asprintf(&dst, "%s/%s", job->dirname, opts.test_script) < 0 ||
+        copy_file(opts.test_script, dst) < 0) {
+        fprintf(stderr, "Error: Cannot copy '%s' into '%s'. %s.\n",
+                opts.test_script, job->dirname, strerror(errno));
+        free(dst);
+        job->state = FAILED;
+        return;
+    }
+    free(dst);
+
+    fflush(stdout);
+    if ((job->pid = fork()) < 0) {
+        fprintf(stderr, "Error: fork() failed. %s.\n", strerror(errno));
+        job->state = FAILED;
+        return;
+    }
+    if (job->pid == 0) {
+        run_job(job);
+    }
+    /* Set it from both sides so kill(-pid) works no matter who runs first. */
+    setpgid(job->pid, job->pid);
+    job->state = RUNNING;
+    job->live = true;
+}
+
+/**
+ * Returns true if job has not started yet and no other job is using its
+ * folder.
+ */
+bool can_start(const Job *job) {
+    return job->state == PENDING &&
+           (job->after == NULL ||
+            (job->after->state != PENDING && !job->after->live));
+}
+
+/**
+ * Links every job to the previous job that unpacks into the same folder, e.g.
+ * hw1_lee_jae.zip and hw1_lee_jae_late.zip. grade.sh grades those one after
+ * the other, so they must not run at the same time here either.
+ */
+void link_same_dirs(Job *jobs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = i; j-- > 0; ) {
+            if (strcmp(jobs[i].dirname, jobs[j].dirname) == 0) {
+                fprintf(stderr, "Warning: '%s' and '%s' both unpack into "
+                        "'%s'; grading them one after the other.\n",
+                        jobs[j].zip, jobs[i].zip, jobs[i].dirname);
+                jobs[i].after = &jobs[j];
+                break;
+            }
+        }
+    }
+}
+
+void print_file(const char *dir, const char *name) {
+    char *path;
+    if (asprintf(&path, "%s/%s", dir, name) < 0) {
+        return;
+    }
+    FILE *fp = fopen(path, "r");
+    free(path);
+    if (fp == NULL) {
+        return;
+    }
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        fwrite(buf, 1, n, stdout);
+    }
+    fclose(fp);
+}
+
+void finish_job(Job *job, int status) {
+    job->seconds = elapsed_since(&job->start);
+    job->status = status;
+    if (job->state != TIMED_OUT) {
+        job->state = DONE;
+    }
+    /* Kill anything the test script left running in the background. */
+    kill(-job->pid, SIGKILL);
+
+    /* Only a test script that ran to completion gives a result worth
+     * reusing; a timeout or a crash might not happen next time. */
+    if (job->cache_path != NULL && job->state == DONE && WIFEXITED(status)) {
+        store_cached(job);
+    }
+
+    if (opts.verbose) {
+        print_file(job->dirname, "grade.txt");
+    }
+    if (job->state == TIMED_OUT) {
+        printf("%s: timed out after %.2f s.\n", job->dirname, job->seconds);
+    } else if (WIFSIGNALED(status)) {
+        printf("%s: killed by signal %d (%s) after %.2f s.\n", job->dirname,
+               WTERMSIG(status), strsignal(WTERMSIG(status)), job->seconds);
+    } else {
+        printf("%s: exited with status %d after %.2f s.\n", job->dirname,
+               WEXITSTATUS(status), job->seconds);
+    }
+    fflush(stdout);
+}
+
+int compare_seconds_desc(const void *a, const void *b) {
+    double x = (*(Job *const *)a)->seconds, y = (*(Job *const *)b)->seconds;
+    return (x < y) - (x > y);
+}
+
+void print_summary(Job *jobs, size_t count, double wall) {
+    size_t done = 0, failed = 0, timed_out = 0, cached = 0, timed = 0;
+    double total = 0;
+    Job **by_time = malloc((count ? count : 1) * sizeof(Job *));
+
+    for (size_t i = 0; i < count; i++) {
+        switch (jobs[i].state) {
+            case DONE:      done++;      break;
+            case TIMED_OUT: timed_out++; break;
+            case CACHED:    cached++;    continue;
+            default:        failed++;    continue;
+        }
+        total += jobs[i].seconds;
+        by_time[timed++] = &jobs[i];
+    }
+    qsort(by_time, timed, sizeof(Job *), compare_seconds_desc);
+
+    printf("\nSummary\n-------\n");
+    printf("Submissions : %zu (%zu graded, %zu cached, %zu timed out, "
+           "%zu failed to start)\n", count, done, cached, timed_out, failed);
+    if (opts.cache_dir != NULL) {
+        printf("Cache       : %zu hit%s, %zu miss%s in %s\n", cached,
+               cached == 1 ? "" : "s", count - cached,
+               count - cached == 1 ? "" : "es", opts.cache_dir);
+    }
+    printf("Wall clock  : %.2f s with %d worker%s\n", wall, opts.jobs,
+           opts.jobs == 1 ? "" : "s");
+    if (timed > 0) {
+        printf("Job time    : %.2f s total, min %.2f s, median %.2f s, "
+               "mean %.2f s, max %.2f s\n", total,
+               by_time[timed - 1]->seconds, by_time[timed / 2]->seconds,
+               total / timed, by_time[0]->seconds);
+        printf("Slowest     :");
+        for (size_t i = 0; i < timed && i < SLOWEST_SHOWN; i++) {
+            printf("%s %s (%.2f s)", i ? "," : "", by_time[i]->dirname,
+                   by_time[i]->seconds);
+        }
+        printf("\n");
+    }
+    free(by_time);
+}
+
+void display_usage(char *progname) {
+    fprintf(stderr, "Usage: %s [-j jobs] [-t timeout_secs] [-m memory_mb] "
+            "[-a archive] [-s test_script] [-c cache_dir | -n] [-v]\n",
+            progname);
+}
+
+bool parse_positive(const char *s, long *value) {
+    char *end;
+    errno = 0;
+    *value = strtol(s, &end, 10);
+    return errno == 0 && *end == '\0' && end != s && *value > 0;
+}
+
+int main(int argc, char *argv[]) {
+    long nprocs = sysconf(_SC_NPROCESSORS_ONLN), value;
+    opts.archive = DEFAULT_ARCHIVE;
+    opts.test_script = DEFAULT_TEST_SCRIPT;
+    opts.cache_dir = DEFAULT_CACHE_DIR;
+    opts.jobs = nprocs > 0 ? (int)nprocs : 1;
+    opts.timeout = DEFAULT_TIMEOUT;
+    opts.memory_mb = DEFAULT_MEMORY;
+
+    int opt;
+    opterr = 0;
+    while ((opt = getopt(argc, argv, ":j:t:m:a:s:c:nv")) != -1) {
+        switch (opt) {
+            case 'j':
+            case 't':
+            case 'm':
+                if (!parse_positive(optarg, &value) || value > 1000000) {
+                    fprintf(stderr, "Error: Invalid value '%s' for '-%c'.\n",
+                            optarg, opt);
+                    return EXIT_FAILURE;
+                }
+                if (opt == 'j') {
+                    opts.jobs = value;
+                } else if (opt == 't') {
+                    opts.timeout = value;
+                } else {
+                    opts.memory_mb = value;
+                }
+                break;
+            case 'a':
+                opts.archive = optarg;
+                break;
+            case 's':
+                opts.test_script = optarg;
+                break;
+            case 'c':
+                opts.cache_dir = optarg;
+                break;
+            case 'n':
+                opts.cache_dir = NULL;
+                break;
+            case 'v':
+                opts.verbose = true;
+                break;
+            case ':':
+                fprintf(stderr, "Error: Option '-%c' requires an argument.\n",
+                        optopt);
+                display_usage(argv[0]);
+                return EXIT_FAILURE;
+            default:
+                fprintf(stderr, "Error: Unknown option '-%c' received.\n",
+                        optopt);
+                display_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc) {
+        display_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (strchr(opts.test_script, '/') != NULL) {
+        fprintf(stderr, "Error: The test script must be in the current "
+                "directory.\n");
+        return EXIT_FAILURE;
+    }
+
+    char script_hash[SHA256_HEX_SIZE];
+    if (sha256_file(opts.test_script, script_hash) < 0) {
+        fprintf(stderr, "Error: Cannot read test script '%s'. %s.\n",
+                opts.test_script, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (opts.cache_dir != NULL && mkdir(opts.cache_dir, 0755) < 0 &&
+        errno != EEXIST) {
+        fprintf(stderr, "Warning: Cannot create cache folder '%s'. %s.\n",
+                opts.cache_dir, strerror(errno));
+        opts.cache_dir = NULL;
+    }
+
+    char *unzip[] = { "unzip", "-o", "-q", opts.archive, NULL };
+    if (run_command(unzip) != 0) {
+        fprintf(stderr, "Error: Cannot unzip '%s'.\n", opts.archive);
+        return EXIT_FAILURE;
+    }
+
+    glob_t zips;
+    if (glob("*.zip", 0, NULL, &zips) != 0) {
+        zips.gl_pathc = 0;
+    }
+    Job *jobs = calloc(zips.gl_pathc ? zips.gl_pathc : 1, sizeof(Job));
+    size_t count = 0;
+    for (size_t i = 0; i < zips.gl_pathc; i++) {
+        if (strcmp(zips.gl_pathv[i], opts.archive) != 0) {
+            jobs[count].zip = zips.gl_pathv[i];
+            jobs[count].dirname = make_dirname(zips.gl_pathv[i]);
+            count++;
+        }
+    }
+    link_same_dirs(jobs, count);
+
+    /* SIGCHLD, SIGINT and SIGTERM are only ever received via sigtimedwait()
+     * in the loop below, so there are no asynchronous handlers to worry
+     * about. */
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t finished = 0;
+    int running = 0;
+
+    while (finished < count) {
+        for (size_t i = 0; i < count && running < opts.jobs; i++) {
+            if (!can_start(&jobs[i])) {
+                continue;
+            }
+            start_job(&jobs[i], script_hash);
+            if (jobs[i].state == RUNNING) {
+                running++;
+            } else {
+                finished++;
+            }
+        }
+
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (size_t i = 0; i < count; i++) {
+                if (jobs[i].live && jobs[i].pid == pid) {
+                    jobs[i].live = false;
+                    finish_job(&jobs[i], status);
+                    running--;
+                    finished++;
+                    break;
+                }
+            }
+        }
+        if (finished == count) {
+            break;
+        }
+        bool startable = false;
+        for (size_t i = 0; i < count && !startable; i++) {
+            startable = can_start(&jobs[i]);
+        }
+        if (running < opts.jobs && startable) {
+            continue;
+        }
+
+        /* Sleep until a child exits or the nearest deadline passes. */
+        double wait_secs = opts.timeout;
+        for (size_t i = 0; i < count; i++) {
+            if (jobs[i].state == RUNNING) {
+                double left = opts.timeout - elapsed_since(&jobs[i].start);
+                if (left <= 0) {
+                    kill(-jobs[i].pid, SIGKILL);
+                    jobs[i].state = TIMED_OUT;
+                } else if (left < wait_secs) {
+                    wait_secs = left;
+                }
+            }
+        }
+        struct timespec ts = { (time_t)wait_secs,
+                               (long)((wait_secs - (time_t)wait_secs) * 1e9) };
+        int sig = sigtimedwait(&signals, NULL, &ts);
+        if (sig == SIGINT || sig == SIGTERM) {
+            fprintf(stderr, "Interrupted, killing running jobs.\n");
+            for (size_t i = 0; i < count; i++) {
+                if (jobs[i].state == RUNNING) {
+                    kill(-jobs[i].pid, SIGKILL);
+                }
+            }
+            while (wait(NULL) > 0) {
+            }
+            return EXIT_FAILURE;
+        }
+    }
+
+    print_summary(jobs, count, elapsed_since(&start));
+
+    for (size_t i = 0; i < count; i++) {
+        free(jobs[i].dirname);
+        free(jobs[i].cache_path);
+    }
+    free(jobs);
+    globfree(&zips);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,33 @@
+/*******************************************************************************
+ * Name        : sha256.h
+ * Description : A small SHA-256 implementation (FIPS 180-4), used to key the
+ *               grading cache by the contents of the submission and of the
+ *               test script.
+ ******************************************************************************/
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_HEX_SIZE    (2 * SHA256_DIGEST_SIZE + 1)
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;        /* bytes hashed so far */
+    unsigned char block[64];
+    size_t used;            /* bytes waiting in block */
+} Sha256;
+
+void sha256_init(Sha256 *ctx);
+void sha256_update(Sha256 *ctx, const void *data, size_t len);
+void sha256_final(Sha256 *ctx, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * Hashes the file at path and writes the digest as 64 lowercase hex digits
+ * plus a '\0' to hex. Returns 0 on success and -1 with errno set on error.
+ */
+int sha256_file(const char *path, char hex[SHA256_HEX_SIZE]);
+
+#endif
@@ -0,0 +1,675 @@
+/*******************************************************************************
+ * Name        : bitmap.c
+ * Description : Dense and Roaring-style bitmaps; see bitmap.h.
+ ******************************************************************************/
+#if defined(__x86_64__) || defined(__i386__)
+#define BITMAP_X86 1
+#include <immintrin.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include "bitmap.h"
+
+#define CONTAINER_WORDS 1024    /* 65536 bits */
+#define RANK_GROUP      8       /* words per entry in a Bitset rank index */
+
+typedef enum { OP_AND, OP_OR, OP_ANDNOT } BitOp;
+
+/* ------------------------------------------------------------ word kernels */
+
+static void words_op_scalar(uint64_t *dst, const uint64_t *a,
+                            const uint64_t *b, size_t n, BitOp op) {
+    switch (op) {
+        case OP_AND:
+            for (size_t i = 0; i < n; i++) dst[i] = a[i] & b[i];
+            break;
+        case OP_OR:
+            for (size_t i = 0; i < n; i++) dst[i] = a[i] | b[i];
+            break;
+        case OP_ANDNOT:
+            for (size_t i = 0; i < n; i++) dst[i] = a[i] & ~b[i];
+            break;
+    }
+}
+
+static uint64_t words_popcount_sw(const uint64_t *words, size_t n) {
+    uint64_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        count += __builtin_popcountll(words[i]);
+    }
+    return count;
+}
+
+#ifdef BITMAP_X86
+/*
+ * The same loops, 4 words (256 bits) at a time. Unaligned loads cost nothing
+ * extra on aligned data, so the same code serves the Bitset words (aligned
+ * to 32 bytes) and any sub-range of them.
+ */
+#define AVX2_LOOP(expr)                                                       \
+    for (; i + 4 <= n; i += 4) {                                              \
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));            \
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));            \
+        _mm256_storeu_si256((__m256i *)(dst + i), expr);                      \
+    }
+
+__attribute__((target("avx2")))
+static void words_op_avx2(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                          size_t n, BitOp op) {
+    size_t i = 0;
+    switch (op) {
+        case OP_AND:
+            AVX2_LOOP(_mm256_and_si256(va, vb));
+            break;
+        case OP_OR:
+            AVX2_LOOP(_mm256_or_si256(va, vb));
+            break;
+        case OP_ANDNOT:
+            /* _mm256_andnot_si256(x, y) is ~x & y. */
+            AVX2_LOOP(_mm256_andnot_si256(vb, va));
+            break;
+    }
+    words_op_scalar(dst + i, a + i, b + i, n - i, op);
+}
+
+__attribute__((target("popcnt")))
+static uint64_t words_popcount_hw(const uint64_t *words, size_t n) {
+    uint64_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        count += __builtin_popcountll(words[i]);
+    }
+    return count;
+}
+
+/*
+ * CPU features are checked once; the answer cannot change while we run.
+ */
+static int cpu_has(int feature) {
+    static int avx2 = -1, popcnt = -1;
+    if (avx2 < 0) {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2") != 0;
+        popcnt = __builtin_cpu_supports("popcnt") != 0;
+    }
+    return feature ? popcnt : avx2;
+}
+#define HAVE_AVX2   cpu_has(0)
+#define HAVE_POPCNT cpu_has(1)
+
+static void words_op(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                     size_t n, BitOp op) {
+    if (HAVE_AVX2) {
+        words_op_avx2(dst, a, b, n, op);
+    } else {
+        words_op_scalar(dst, a, b, n, op);
+    }
+}
+
+static uint64_t words_popcount(const uint64_t *words, size_t n) {
+    return HAVE_POPCNT ? words_popcount_hw(words, n)
+                       : words_popcount_sw(words, n);
+}
+#else
+/* Other CPUs get the portable loops; the compiler picks their instructions. */
+#define words_op        words_op_scalar
+#define words_popcount  words_popcount_sw
+#endif
+
+/* Bits 0 to bit of a word, inclusive. */
+static uint64_t mask_through(unsigned bit) {
+    return bit == 63 ? ~(uint64_t)0 : ((uint64_t)1 << (bit + 1)) - 1;
+}
+
+/* ------------------------------------------------------------------ Bitset */
+
+int bitset_init(Bitset *b, size_t num_bits) {
+    b->num_bits = num_bits;
+    b->num_words = (num_bits + 63) / 64;
+    b->ranks = NULL;
+
+    /* Round up to whole 32-byte AVX2 vectors for aligned_alloc(). */
+    size_t bytes = ((b->num_words * sizeof(uint64_t) + 31) / 32) * 32;
+    b->words = aligned_alloc(32, bytes ? bytes : 32);
+    if (b->words == NULL) {
+        return -1;
+    }
+    memset(b->words, 0, bytes);
+    return 0;
+}
+
+void bitset_free(Bitset *b) {
+    free(b->words);
+    free(b->ranks);
+    memset(b, 0, sizeof(*b));
+}
+
+static void bitset_op(Bitset *dst, const Bitset *a, const Bitset *b,
+                      BitOp op) {
+    free(dst->ranks);
+    dst->ranks = NULL;
+    words_op(dst->words, a->words, b->words, dst->num_words, op);
+}
+
+void bitset_and(Bitset *dst, const Bitset *a, const Bitset *b) {
+    bitset_op(dst, a, b, OP_AND);
+}
+
+void bitset_or(Bitset *dst, const Bitset *a, const Bitset *b) {
+    bitset_op(dst, a, b, OP_OR);
+}
+
+void bitset_andnot(Bitset *dst, const Bitset *a, const Bitset *b) {
+    bitset_op(dst, a, b, OP_ANDNOT);
+}
+
+size_t bitset_cardinality(const Bitset *b) {
+    return words_popcount(b->words, b->num_words);
+}
+
+int bitset_build_rank(Bitset *b) {
+    size_t groups = b->num_words / RANK_GROUP + 1;
+    uint64_t *ranks = realloc(b->ranks, groups * sizeof(uint64_t));
+    if (ranks == NULL) {
+        return -1;
+    }
+    uint64_t count = 0;
+    for (size_t g = 0; g < groups; g++) {
+        ranks[g] = count;
+        size_t start = g * RANK_GROUP;
+        if (start < b->num_words) {
+            size_t n = b->num_words - start;
+            count += words_popcount(b->words + start,
+                                    n < RANK_GROUP ? n : RANK_GROUP);
+        }
+    }
+    b->ranks = ranks;
+    return 0;
+}
+
+size_t bitset_rank(const Bitset *b, size_t i) {
+    if (b->num_bits == 0) {
+        return 0;
+    }
+    if (i >= b->num_bits) {
+        i = b->num_bits - 1;
+    }
+    size_t word = i >> 6, start = 0, count = 0;
+    if (b->ranks != NULL) {
+        start = word / RANK_GROUP * RANK_GROUP;
+        count = b->ranks[word / RANK_GROUP];
+    }
+    count += words_popcount(b->words + start, word - start);
+    return count + __builtin_popcountll(b->words[word] & mask_through(i & 63));
+}
+
+/* -------------------------------------------------------------- containers */
+
+static void container_free(Container *c) {
+    if (c->is_bitmap) {
+        free(c->bits);
+    } else {
+        free(c->array);
+    }
+}
+
+/**
+ * Returns the index of the first value in array[0..n) that is >= value.
+ */
+static uint32_t lower_bound(const uint16_t *array, uint32_t n,
+                            uint16_t value) {
+    uint32_t lo = 0, hi = n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (array[mid] < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void array_to_bits(const uint16_t *array, uint32_t n, uint64_t *bits) {
+    memset(bits, 0, CONTAINER_WORDS * sizeof(uint64_t));
+    for (uint32_t i = 0; i < n; i++) {
+        bits[array[i] >> 6] |= (uint64_t)1 << (array[i] & 63);
+    }
+}
+
+static int container_to_bitmap(Container *c) {
+    uint64_t *bits = malloc(CONTAINER_WORDS * sizeof(uint64_t));
+    if (bits == NULL) {
+        return -1;
+    }
+    array_to_bits(c->array, c->cardinality, bits);
+    free(c->array);
+    c->bits = bits;
+    c->is_bitmap = true;
+    c->capacity = 0;
+    return 0;
+}
+
+static void bits_to_array(const uint64_t *bits, uint16_t *array) {
+    uint32_t n = 0;
+    for (uint32_t w = 0; w < CONTAINER_WORDS; w++) {
+        /* Peel off the lowest set bit until the word is empty. */
+        for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+            array[n++] = (uint16_t)(w * 64 + __builtin_ctzll(word));
+        }
+    }
+}
+
+/**
+ * Turns the bitmap bits, which has cardinality values, into container c,
+ * choosing whichever representation is smaller. Takes ownership of bits.
+ */
+static int container_from_bits(Container *c, uint64_t *bits,
+                               uint32_t cardinality) {
+    c->cardinality = cardinality;
+    if (cardinality > ROARING_ARRAY_MAX) {
+        c->is_bitmap = true;
+        c->bits = bits;
+        c->capacity = 0;
+        return 0;
+    }
+    c->is_bitmap = false;
+    c->capacity = cardinality;
+    c->array = malloc((cardinality ? cardinality : 1) * sizeof(uint16_t));
+    if (c->array == NULL) {
+        free(bits);
+        return -1;
+    }
+    bits_to_array(bits, c->array);
+    free(bits);
+    return 0;
+}
+
+static int container_copy(Container *dst, const Container *src) {
+    *dst = *src;
+    size_t bytes = src->is_bitmap ? CONTAINER_WORDS * sizeof(uint64_t)
+                                  : (src->cardinality ? src->cardinality : 1) *
+                                        sizeof(uint16_t);
+    void *copy = malloc(bytes);
+    if (copy == NULL) {
+        return -1;
+    }
+    if (src->is_bitmap) {
+        memcpy(copy, src->bits, bytes);
+        dst->bits = copy;
+    } else {
+        memcpy(copy, src->array, src->cardinality * sizeof(uint16_t));
+        dst->array = copy;
+        dst->capacity = src->cardinality ? src->cardinality : 1;
+    }
+    return 0;
+}
+
+/**
+ * Merges two sorted arrays. keep_a/keep_both/keep_b say which values to
+ * output: those only in a, those in both, and those only in b.
+ */
+static uint32_t array_merge(uint16_t *out, const uint16_t *a, uint32_t na,
+                            const uint16_t *b, uint32_t nb, bool keep_a,
+                            bool keep_both, bool keep_b) {
+    uint32_t i = 0, j = 0, n = 0;
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            if (keep_a) out[n++] = a[i];
+            i++;
+        } else if (a[i] > b[j]) {
+            if (keep_b) out[n++] = b[j];
+            j++;
+        } else {
+            if (keep_both) out[n++] = a[i];
+            i++;
+            j++;
+        }
+    }
+    for (; keep_a && i < na; i++) out[n++] = a[i];
+    for (; keep_b && j < nb; j++) out[n++] = b[j];
+    return n;
+}
+
+/**
+ * Keeps the values of array that are (keep_set) or are not (!keep_set) in
+ * the bitmap bits.
+ */
+static int array_filter(Container *out, const Container *array,
+                        const uint64_t *bits, bool keep_set) {
+    out->is_bitmap = false;
+    out->capacity = array->cardinality ? array->cardinality : 1;
+    out->array = malloc(out->capacity * sizeof(uint16_t));
+    if (out->array == NULL) {
+        return -1;
+    }
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < array->cardinality; i++) {
+        uint16_t v = array->array[i];
+        bool set = (bits[v >> 6] >> (v & 63)) & 1;
+        if (set == keep_set) {
+            out->array[n++] = v;
+        }
+    }
+    out->cardinality = n;
+    return 0;
+}
+
+static int container_op(Container *out, const Container *a,
+                        const Container *b, BitOp op) {
+    out->key = a->key;
+
+    if (!a->is_bitmap && !b->is_bitmap) {
+        uint32_t max = op == OP_OR ? a->cardinality + b->cardinality
+                                   : a->cardinality;
+        uint16_t *merged = malloc((max ? max : 1) * sizeof(uint16_t));
+        if (merged == NULL) {
+            return -1;
+        }
+        uint32_t n = array_merge(merged, a->array, a->cardinality, b->array,
+                                 b->cardinality, op != OP_AND, op != OP_ANDNOT,
+                                 op == OP_OR);
+        out->is_bitmap = false;
+        out->array = merged;
+        out->capacity = max ? max : 1;
+        out->cardinality = n;
+        if (n > ROARING_ARRAY_MAX) {
+            return container_to_bitmap(out);
+        }
+        return 0;
+    }
+
+    /* A small array against a bitmap only needs one bit test per value. */
+    if (!a->is_bitmap && op != OP_OR) {
+        return array_filter(out, a, b->bits, op == OP_AND);
+    }
+    if (!b->is_bitmap && op == OP_AND) {
+        return array_filter(out, b, a->bits, true);
+    }
+
+    uint64_t tmp[CONTAINER_WORDS];
+    const uint64_t *abits = a->bits, *bbits = b->bits;
+    if (!a->is_bitmap) {
+        array_to_bits(a->array, a->cardinality, tmp);
+        abits = tmp;
+    } else if (!b->is_bitmap) {
+        array_to_bits(b->array, b->cardinality, tmp);
+        bbits = tmp;
+    }
+    uint64_t *bits = malloc(CONTAINER_WORDS * sizeof(uint64_t));
+    if (bits == NULL) {
+        return -1;
+    }
+    words_op(bits, abits, bbits, CONTAINER_WORDS, op);
+    return container_from_bits(out, bits,
+                               words_popcount(bits, CONTAINER_WORDS));
+}
+
+/* ----------------------------------------------------------------- Roaring */
+
+void roaring_init(Roaring *r) {
+    r->containers = NULL;
+    r->count = 0;
+    r->capacity = 0;
+}
+
+void roaring_free(Roaring *r) {
+    for (uint32_t i = 0; i < r->count; i++) {
+        container_free(&r->containers[i]);
+    }
+    free(r->containers);
+    roaring_init(r);
+}
+
+/**
+ * Returns the index of the container for key, or if there is none, the index
+ * at which it would be inserted, with *found set accordingly.
+ */
+static uint32_t find_container(const Roaring *r, uint16_t key, bool *found) {
+    uint32_t lo = 0, hi = r->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (r->containers[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *found = lo < r->count && r->containers[lo].key == key;
+    return lo;
+}
+
+/**
+ * Makes room for one more container at the end, for building results in key
+ * order.
+ */
+static Container *push_container(Roaring *r) {
+    if (r->count == r->capacity) {
+        uint32_t capacity = r->capacity ? r->capacity * 2 : 16;
+        Container *c = realloc(r->containers, capacity * sizeof(Container));
+        if (c == NULL) {
+            return NULL;
+        }
+        r->containers = c;
+        r->capacity = capacity;
+    }
+    return &r->containers[r->count++];
+}
+
+int roaring_add(Roaring *r, uint32_t value) {
+    uint16_t key = value >> 16, low = value & 0xffff;
+    bool found;
+    uint32_t idx = find_container(r, key, &found);
+
+    if (!found) {
+        if (push_container(r) == NULL) {
+            return -1;
+        }
+        memmove(&r->containers[idx + 1], &r->containers[idx],
+                (r->count - 1 - idx) * sizeof(Container));
+        Container *c = &r->containers[idx];
+        memset(c, 0, sizeof(*c));
+        c->key = key;
+        c->capacity = 4;
+        if ((c->array = malloc(c->capacity * sizeof(uint16_t))) == NULL) {
+            memmove(&r->containers[idx], &r->containers[idx + 1],
+                    (--r->count - idx) * sizeof(Container));
+            return -1;
+        }
+    }
+
+    Container *c = &r->containers[idx];
+    if (!c->is_bitmap) {
+        uint32_t pos = lower_bound(c->array, c->cardinality, low);
+        if (pos < c->cardinality && c->array[pos] == low) {
+            return 0;
+        }
+        if (c->cardinality < ROARING_ARRAY_MAX) {
+            if (c->cardinality == c->capacity) {
+                uint32_t capacity = c->capacity * 2;
+                if (capacity > ROARING_ARRAY_MAX) {
+                    capacity = ROARING_ARRAY_MAX;
+                }
+                uint16_t *array = realloc(c->array,
+                                          capacity * sizeof(uint16_t));
+                if (array == NULL) {
+                    return -1;
+                }
+                c->array = array;
+                c->capacity = capacity;
+            }
+            memmove(&c->array[pos + 1], &c->array[pos],
+                    (c->cardinality - pos) * sizeof(uint16_t));
+            c->array[pos] = low;
+            c->cardinality++;
+            return 0;
+        }
+        if (container_to_bitmap(c) < 0) {
+            return -1;
+        }
+    }
+    uint64_t bit = (uint64_t)1 << (low & 63);
+    if (!(c->bits[low >> 6] & bit)) {
+        c->bits[low >> 6] |= bit;
+        c->cardinality++;
+    }
+    return 0;
+}
+
+void roaring_remove(Roaring *r, uint32_t value) {
+    uint16_t key = value >> 16, low = value & 0xffff;
+    bool found;
+    uint32_t idx = find_container(r, key, &found);
+    if (!found) {
+        return;
+    }
+
+    Container *c = &r->containers[idx];
+    if (c->is_bitmap) {
+        uint64_t bit = (uint64_t)1 << (low & 63);
+        if (c->bits[low >> 6] & bit) {
+            c->bits[low >> 6] &= ~bit;
+            c->cardinality--;
+        }
+        /* Shrink back to an array once it is small enough; if that fails we
+         * simply stay a (valid) bitmap. */
+        uint16_t *array;
+        if (c->cardinality == ROARING_ARRAY_MAX &&
+            (array = malloc(ROARING_ARRAY_MAX * sizeof(uint16_t))) != NULL) {
+            bits_to_array(c->bits, array);
+            free(c->bits);
+            c->array = array;
+            c->capacity = ROARING_ARRAY_MAX;
+            c->is_bitmap = false;
+        }
+    } else {
+        uint32_t pos = lower_bound(c->array, c->cardinality, low);
+        if (pos < c->cardinality && c->array[pos] == low) {
+            memmove(&c->array[pos], &c->array[pos + 1],
+                    (c->cardinality - pos - 1) * sizeof(uint16_t));
+            c->cardinality--;
+        }
+    }
+    if (c->cardinality == 0) {
+        container_free(c);
+        memmove(&r->containers[idx], &r->containers[idx + 1],
+                (--r->count - idx) * sizeof(Container));
+    }
+}
+
+bool roaring_contains(const Roaring *r, uint32_t value) {
+    uint16_t key = value >> 16, low = value & 0xffff;
+    bool found;
+    uint32_t idx = find_container(r, key, &found);
+    if (!found) {
+        return false;
+    }
+    const Container *c = &r->containers[idx];
+    if (c->is_bitmap) {
+        return (c->bits[low >> 6] >> (low & 63)) & 1;
+    }
+    uint32_t pos = lower_bound(c->array, c->cardinality, low);
+    return pos < c->cardinality && c->array[pos] == low;
+}
+
+/**
+ * Walks the keys of a and b in order, like the merge step of merge sort,
+ * combining containers with matching keys and copying the others if op
+ * keeps them.
+ */
+static int roaring_op(Roaring *dst, const Roaring *a, const Roaring *b,
+                      BitOp op) {
+    roaring_free(dst);
+    uint32_t i = 0, j = 0;
+
+    while (i < a->count || j < b->count) {
+        const Container *ca = i < a->count ? &a->containers[i] : NULL;
+        const Container *cb = j < b->count ? &b->containers[j] : NULL;
+        const Container *only = NULL;
+        if (ca && cb && ca->key == cb->key) {
+            i++;
+            j++;
+        } else if (cb == NULL || (ca && ca->key < cb->key)) {
+            i++;
+            if (op == OP_AND) continue;
+            only = ca;
+        } else {
+            j++;
+            if (op != OP_OR) continue;
+            only = cb;
+        }
+
+        Container *out = push_container(dst);
+        if (out == NULL) {
+            goto FAILURE;
+        }
+        int result = only ? container_copy(out, only)
+                          : container_op(out, ca, cb, op);
+        if (result < 0) {
+            dst->count--;
+            goto FAILURE;
+        }
+        if (out->cardinality == 0) {
+            container_free(out);
+            dst->count--;
+        }
+    }
+    return 0;
+
+FAILURE:
+    roaring_free(dst);
+    return -1;
+}
+
+int roaring_and(Roaring *dst, const Roaring *a, const Roaring *b) {
+    return roaring_op(dst, a, b, OP_AND);
+}
+
+int roaring_or(Roaring *dst, const Roaring *a, const Roaring *b) {
+    return roaring_op(dst, a, b, OP_OR);
+}
+
+int roaring_andnot(Roaring *dst, const Roaring *a, const Roaring *b) {
+    return roaring_op(dst, a, b, OP_ANDNOT);
+}
+
+uint64_t roaring_cardinality(const Roaring *r) {
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < r->count; i++) {
+        count += r->containers[i].cardinality;
+    }
+    return count;
+}
+
+uint64_t roaring_rank(const Roaring *r, uint32_t value) {
+    uint16_t key = value >> 16, low = value & 0xffff;
+    uint64_t count = 0;
+    uint32_t i = 0;
+    for (; i < r->count && r->containers[i].key < key; i++) {
+        count += r->containers[i].cardinality;
+    }
+    if (i == r->count || r->containers[i].key != key) {
+        return count;
+    }
+    const Container *c = &r->containers[i];
+    if (c->is_bitmap) {
+        return count + words_popcount(c->bits, low >> 6) +
+               __builtin_popcountll(c->bits[low >> 6] &
+                                    mask_through(low & 63));
+    }
+    /* Values <= low are those before the first value > low. */
+    uint32_t pos = lower_bound(c->array, c->cardinality, low);
+    if (pos < c->cardinality && c->array[pos] == low) {
+        pos++;
+    }
+    return count + pos;
+}
+
+size_t roaring_size_in_bytes(const Roaring *r) {
+    size_t bytes = r->count * sizeof(Container);
+    for (uint32_t i = 0; i < r->count; i++) {
+        const Container *c = &r->containers[i];
+        bytes += c->is_bitmap ? CONTAINER_WORDS * sizeof(uint64_t)
+                              : c->capacity * sizeof(uint16_t);
+    }
+    return bytes;
+}
@@ -0,0 +1,131 @@
+/*******************************************************************************
+ * Name        : bitmap.h
+ * Description : Sets of unsigned integers stored as bits, built on the same
+ *               masks as set_bit() in bitoperators.c, but over arrays of
+ *               64-bit words instead of a single int.
+ *
+ *               Bitset  - a plain dense bitmap: bit i of the set is bit
+ *                         (i % 64) of word i / 64. Fast and simple, but it
+ *                         takes max_value / 8 bytes no matter how few
+ *                         values are in the set.
+ *
+ *               Roaring - a compressed bitmap in the style of Roaring
+ *                         bitmaps. 32-bit values are split into a 16-bit key
+ *                         (high half) and 16-bit low half. Each key that has
+ *                         values gets a container: a sorted array of low
+ *                         halves while it holds at most 4096 values, and a
+ *                         65536-bit Bitset-style block once it holds more.
+ *                         Sparse sets cost 2 bytes per value, dense ones
+ *                         1 bit per possible value.
+ *
+ *               On x86, AND, OR and ANDNOT process 256 bits per instruction
+ *               with AVX2 when the CPU has it, and cardinality and rank are
+ *               computed with the popcnt instruction. Other CPUs use plain
+ *               C loops.
+ ******************************************************************************/
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* ---------------------------------------------------------------- Bitset */
+
+typedef struct {
+    uint64_t *words;
+    size_t num_words;
+    size_t num_bits;
+    uint64_t *ranks;    /* set bits before each group of 8 words, or NULL */
+} Bitset;
+
+/**
+ * Allocates an empty set that can hold the values 0 to num_bits - 1.
+ * Returns 0 on success and -1 if memory runs out.
+ */
+int bitset_init(Bitset *b, size_t num_bits);
+void bitset_free(Bitset *b);
+
+/* The three operations below do no bounds checking, just like set_bit(). */
+
+static inline void bitset_set(Bitset *b, size_t i) {
+    b->words[i >> 6] |= (uint64_t)1 << (i & 63);
+}
+
+static inline void bitset_clear(Bitset *b, size_t i) {
+    b->words[i >> 6] &= ~((uint64_t)1 << (i & 63));
+}
+
+static inline bool bitset_test(const Bitset *b, size_t i) {
+    return (b->words[i >> 6] >> (i & 63)) & 1;
+}
+
+/**
+ * Sets dst to a AND b, a OR b, or a AND NOT b. All three sets must have the
+ * same size; dst may be the same set as a or b.
+ */
+void bitset_and(Bitset *dst, const Bitset *a, const Bitset *b);
+void bitset_or(Bitset *dst, const Bitset *a, const Bitset *b);
+void bitset_andnot(Bitset *dst, const Bitset *a, const Bitset *b);
+
+size_t bitset_cardinality(const Bitset *b);
+
+/**
+ * Returns the number of values in the set that are <= i. Without a rank index
+ * this counts every word up to i; after bitset_build_rank() it takes at most
+ * eight popcounts. The index is thrown away by any operation that changes
+ * the set through the functions above, but not by bitset_set() and friends,
+ * so rebuild it after changing bits directly.
+ */
+size_t bitset_rank(const Bitset *b, size_t i);
+int bitset_build_rank(Bitset *b);
+
+/* --------------------------------------------------------------- Roaring */
+
+#define ROARING_ARRAY_MAX 4096
+
+typedef struct {
+    uint16_t key;
+    bool is_bitmap;
+    uint32_t cardinality;
+    uint32_t capacity;      /* of array, in values */
+    union {
+        uint16_t *array;    /* sorted, when !is_bitmap */
+        uint64_t *bits;     /* 1024 words, when is_bitmap */
+    };
+} Container;
+
+typedef struct {
+    Container *containers;  /* sorted by key */
+    uint32_t count;
+    uint32_t capacity;
+} Roaring;
+
+void roaring_init(Roaring *r);
+void roaring_free(Roaring *r);
+
+int roaring_add(Roaring *r, uint32_t value);
+void roaring_remove(Roaring *r, uint32_t value);
+bool roaring_contains(const Roaring *r, uint32_t value);
+
+/**
+ * Store a AND b, a OR b, or a AND NOT b in dst, which must be initialized
+ * and must not be a or b. Returns 0 on success and -1 if memory runs out.
+ */
+int roaring_and(Roaring *dst, const Roaring *a, const Roaring *b);
+int roaring_or(Roaring *dst, const Roaring *a, const Roaring *b);
+int roaring_andnot(Roaring *dst, const Roaring *a, const Roaring *b);
+
+uint64_t roaring_cardinality(const Roaring *r);
+
+/**
+ * Returns the number of values in the set that are <= value.
+ */
+uint64_t roaring_rank(const Roaring *r, uint32_t value);
+
+/**
+ * Returns the number of bytes used by the containers.
+ */
+size_t roaring_size_in_bytes(const Roaring *r);
+
+#endif
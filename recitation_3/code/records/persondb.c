@@ -0,0 +1,182 @@
+/*******************************************************************************
+ * Name        : persondb.c
+ * Description : Writes, appends to and reads person record files, to show
+ *               how a fixed record layout lets a program use a file of
+ *               structs straight from mmap() instead of parsing it.
+ ******************************************************************************/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "personfile.h"
+
+#define KEEP_COLUMNS (~0u)
+
+double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void display_usage(char *progname) {
+    fprintf(stderr,
+            "Usage: %s write <file> <count> [id,age,name]\n"
+            "       %s append <file> <count> [id,age,name]\n"
+            "       %s stats <file>\n"
+            "       %s print <file> [count]\n"
+            "append keeps the file's column blocks unless a list is given, "
+            "in which case\nonly the listed ones are rebuilt.\n",
+            progname, progname, progname, progname);
+}
+
+unsigned parse_columns(const char *list) {
+    unsigned columns = 0;
+    char *copy = strdup(list), *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok != NULL;
+         tok = strtok_r(NULL, ",", &save)) {
+        if (strcmp(tok, "id") == 0) {
+            columns |= PF_COLUMN_ID;
+        } else if (strcmp(tok, "age") == 0) {
+            columns |= PF_COLUMN_AGE;
+        } else if (strcmp(tok, "name") == 0) {
+            columns |= PF_COLUMN_NAME;
+        } else {
+            fprintf(stderr, "Warning: Unknown column '%s' ignored.\n", tok);
+        }
+    }
+    free(copy);
+    return columns;
+}
+
+/**
+ * Writes count records to path. columns selects the column blocks to build;
+ * KEEP_COLUMNS keeps the ones the file already had.
+ */
+int write_people(const char *path, long long count, bool append,
+                 unsigned columns) {
+    static const char *names[] = { "Ada", "Brian", "Grace", "Jae", "John",
+                                   "Ken", "Linus", "Markus", "Stanley",
+                                   "Xurxo" };
+    PersonWriter w;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (pw_open(&w, path, append) < 0) {
+        fprintf(stderr, "Error: Cannot open '%s'. %s.\n", path,
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (columns == KEEP_COLUMNS) {
+        columns = w.columns;
+    }
+    uint64_t first_id = w.record_count;
+    for (long long i = 0; i < count; i++) {
+        Person p;
+        memset(&p, 0, sizeof(p));
+        p.id = first_id + i;
+        p.age = 18 + rand() % 60;
+        snprintf(p.name, sizeof(p.name), "%s %llu", names[i % 10],
+                 (unsigned long long)p.id);
+        if (pw_append(&w, &p) < 0) {
+            fprintf(stderr, "Error: Cannot write '%s'. %s.\n", path,
+                    strerror(errno));
+            pw_close(&w, 0);
+            return EXIT_FAILURE;
+        }
+    }
+    uint64_t total = w.record_count;
+    if (pw_close(&w, columns) < 0) {
+        fprintf(stderr, "Error: Cannot finish '%s'. %s.\n", path,
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+    printf("Wrote %lld records (%" PRIu64 " in total) in %.3f s.\n", count,
+           total, seconds_since(&start));
+    return EXIT_SUCCESS;
+}
+
+int stats_people(const char *path) {
+    PersonReader r;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (pr_open(&r, path) < 0) {
+        fprintf(stderr, "Error: Cannot open '%s'. %s.\n", path,
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+    printf("Opened %" PRIu64 " records in %.6f s.\n", r.record_count,
+           seconds_since(&start));
+
+    /* Prefer the age column: it touches 4 bytes per person instead of a
+     * whole 32-byte record, so only an eighth of the pages fault in. */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t size;
+    const int32_t *ages = pr_column(&r, "age", &size);
+    if (ages != NULL && size != sizeof(int32_t)) {
+        ages = NULL;
+    }
+    int64_t sum = 0;
+    int32_t min = INT32_MAX, max = INT32_MIN;
+    for (uint64_t i = 0; i < r.record_count; i++) {
+        int32_t age = ages ? ages[i] : r.records[i].age;
+        sum += age;
+        min = age < min ? age : min;
+        max = age > max ? age : max;
+    }
+    if (r.record_count > 0) {
+        printf("Ages: min %d, max %d, mean %.2f (from the %s in %.3f s).\n",
+               min, max, (double)sum / r.record_count,
+               ages ? "age column" : "records", seconds_since(&start));
+    }
+    pr_close(&r);
+    return EXIT_SUCCESS;
+}
+
+int print_people(const char *path, long long count) {
+    PersonReader r;
+    if (pr_open(&r, path) < 0) {
+        fprintf(stderr, "Error: Cannot open '%s'. %s.\n", path,
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+    for (uint64_t i = 0; i < r.record_count && (long long)i < count; i++) {
+        const Person *p = &r.records[i];
+        printf("%8" PRIu64 "  %3d  %.*s\n", p->id, p->age, PERSON_NAME_SIZE,
+               p->name);
+    }
+    pr_close(&r);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        display_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    char *cmd = argv[1], *path = argv[2];
+
+    if ((strcmp(cmd, "write") == 0 || strcmp(cmd, "append") == 0) &&
+        (argc == 4 || argc == 5)) {
+        long long count = atoll(argv[3]);
+        if (count < 0) {
+            fprintf(stderr, "Error: Invalid record count '%s'.\n", argv[3]);
+            return EXIT_FAILURE;
+        }
+        bool append = strcmp(cmd, "append") == 0;
+        unsigned columns = argc == 5 ? parse_columns(argv[4]) :
+                           append ? KEEP_COLUMNS : 0;
+        return write_people(path, count, append, columns);
+    }
+    if (strcmp(cmd, "stats") == 0 && argc == 3) {
+        return stats_people(path);
+    }
+    if (strcmp(cmd, "print") == 0 && (argc == 3 || argc == 4)) {
+        return print_people(path, argc == 4 ? atoll(argv[3]) : 10);
+    }
+    display_usage(argv[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,377 @@
+/*******************************************************************************
+ * Name        : personfile.c
+ * Description : Writer and zero-copy reader for the person record files
+ *               described in personfile.h.
+ ******************************************************************************/
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "personfile.h"
+
+#define WRITE_BUFSIZE (1 << 20)
+
+static const struct {
+    const char *name;
+    uint32_t offset, size;
+    unsigned bit;
+} fields[] = {
+    { "id",   offsetof(Person, id),   sizeof(uint64_t),  PF_COLUMN_ID },
+    { "age",  offsetof(Person, age),  sizeof(int32_t),   PF_COLUMN_AGE },
+    { "name", offsetof(Person, name), PERSON_NAME_SIZE,  PF_COLUMN_NAME },
+};
+#define NUM_FIELDS (sizeof(fields) / sizeof(fields[0]))
+
+/**
+ * Returns the index in fields[] of the column described by d, or -1 if d does
+ * not describe one of them exactly: same name, offset and size, and a block
+ * that starts on a PERSONFILE_ALIGN boundary, as pw_close() writes them.
+ */
+static int find_field(const ColumnDesc *d) {
+    for (size_t f = 0; f < NUM_FIELDS; f++) {
+        if (strncmp(d->name, fields[f].name, sizeof(d->name)) == 0) {
+            if (le32toh(d->field_offset) != fields[f].offset ||
+                le32toh(d->field_size) != fields[f].size ||
+                le64toh(d->data_offset) % PERSONFILE_ALIGN != 0) {
+                return -1;
+            }
+            return (int)f;
+        }
+    }
+    return -1;
+}
+
+static uint64_t align_up(uint64_t n) {
+    return (n + PERSONFILE_ALIGN - 1) & ~(uint64_t)(PERSONFILE_ALIGN - 1);
+}
+
+static bool host_is_little_endian(void) {
+    return __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+}
+
+static int write_all(int fd, const void *buf, size_t len, off_t offset) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/**
+ * Checks a header read from a file of file_size bytes. Returns 0 if it
+ * describes a file this code can use, or -1 with errno set to EINVAL.
+ */
+static int check_header(const PersonFileHeader *h, uint64_t file_size) {
+    uint64_t count = le64toh(h->record_count);
+    uint64_t records = le64toh(h->records_offset);
+    uint64_t columns = le64toh(h->columns_offset);
+    uint32_t num_columns = le32toh(h->num_columns);
+
+    if (memcmp(h->magic, PERSONFILE_MAGIC, 4) != 0 ||
+        le16toh(h->version) != PERSONFILE_VERSION ||
+        le16toh(h->header_size) != sizeof(PersonFileHeader) ||
+        le32toh(h->record_size) != sizeof(Person) ||
+        le32toh(h->alignment) != PERSONFILE_ALIGN ||
+        records % PERSONFILE_ALIGN != 0 || records > file_size ||
+        count > (file_size - records) / sizeof(Person) ||
+        (num_columns > 0 &&
+         (columns > file_size ||
+          num_columns > (file_size - columns) / sizeof(ColumnDesc)))) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Returns the PF_COLUMN_* bits of the column blocks in the file on fd, whose
+ * header h has already been checked.
+ */
+static unsigned existing_columns(int fd, const PersonFileHeader *h) {
+    unsigned columns = 0;
+    uint32_t num_columns = le32toh(h->num_columns);
+    off_t offset = le64toh(h->columns_offset);
+    for (uint32_t i = 0; i < num_columns; i++) {
+        ColumnDesc d;
+        if (pread(fd, &d, sizeof(d), offset + i * sizeof(d)) != sizeof(d)) {
+            break;
+        }
+        int f = find_field(&d);
+        if (f >= 0) {
+            columns |= fields[f].bit;
+        }
+    }
+    return columns;
+}
+
+int pw_open(PersonWriter *w, const char *path, bool append) {
+    memset(w, 0, sizeof(*w));
+    PersonFileHeader h;
+
+    w->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (w->fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(w->fd, &st) < 0) {
+        goto FAILURE;
+    }
+    /* Appending to anything but an empty file or a person file this code
+     * wrote would truncate someone else's data, so refuse. */
+    if (append && st.st_size > 0) {
+        if ((size_t)st.st_size < sizeof(h) ||
+            pread(w->fd, &h, sizeof(h), 0) != sizeof(h) ||
+            check_header(&h, st.st_size) < 0 ||
+            le64toh(h.records_offset) != sizeof(h)) {
+            errno = EINVAL;
+            goto FAILURE;
+        }
+        w->record_count = le64toh(h.record_count);
+        w->columns = existing_columns(w->fd, &h);
+    }
+
+    /* Drop the old column blocks (they are rebuilt on close) and write a
+     * header claiming the old record count, so a writer that dies before
+     * pw_close() leaves a valid file holding only the old records. */
+    uint64_t end = sizeof(h) + w->record_count * sizeof(Person);
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, PERSONFILE_MAGIC, 4);
+    h.version = htole16(PERSONFILE_VERSION);
+    h.header_size = htole16(sizeof(h));
+    h.record_size = htole32(sizeof(Person));
+    h.alignment = htole32(PERSONFILE_ALIGN);
+    h.record_count = htole64(w->record_count);
+    h.records_offset = htole64(sizeof(h));
+    if (ftruncate(w->fd, end) < 0 || write_all(w->fd, &h, sizeof(h), 0) < 0 ||
+        lseek(w->fd, end, SEEK_SET) < 0) {
+        goto FAILURE;
+    }
+
+    if ((w->buf = malloc(WRITE_BUFSIZE)) == NULL) {
+        goto FAILURE;
+    }
+    return 0;
+
+FAILURE:
+    close(w->fd);
+    w->fd = -1;
+    return -1;
+}
+
+static int pw_flush(PersonWriter *w) {
+    off_t end = sizeof(PersonFileHeader) +
+                (w->record_count * sizeof(Person)) - w->used;
+    if (write_all(w->fd, w->buf, w->used, end) < 0) {
+        return -1;
+    }
+    w->used = 0;
+    return 0;
+}
+
+int pw_append(PersonWriter *w, const Person *p) {
+    if (w->used + sizeof(Person) > WRITE_BUFSIZE && pw_flush(w) < 0) {
+        return -1;
+    }
+    Person *dst = (Person *)(w->buf + w->used);
+    *dst = *p;
+    if (!host_is_little_endian()) {
+        dst->id = htole64(p->id);
+        dst->age = (int32_t)htole32((uint32_t)p->age);
+    }
+    w->used += sizeof(Person);
+    w->record_count++;
+    return 0;
+}
+
+/**
+ * Copies one field of every record into a contiguous column block starting
+ * at offset. The records are read back through mmap(), so each page of the
+ * file is only read once no matter how many columns are built.
+ */
+static int write_column(PersonWriter *w, const Person *records, size_t field,
+                        uint64_t offset) {
+    uint32_t size = fields[field].size;
+    size_t per_chunk = WRITE_BUFSIZE / size;
+
+    for (uint64_t i = 0; i < w->record_count; ) {
+        size_t n = 0;
+        for (; n < per_chunk && i < w->record_count; n++, i++) {
+            memcpy(w->buf + n * size,
+                   (const char *)&records[i] + fields[field].offset, size);
+        }
+        if (write_all(w->fd, w->buf, n * size, offset) < 0) {
+            return -1;
+        }
+        offset += n * size;
+    }
+    return 0;
+}
+
+int pw_close(PersonWriter *w, unsigned columns) {
+    int result = -1;
+    void *map = MAP_FAILED;
+    uint64_t records_end = sizeof(PersonFileHeader) +
+                           w->record_count * sizeof(Person);
+    ColumnDesc descs[NUM_FIELDS];
+    uint32_t num_columns = 0;
+    uint64_t offset = align_up(records_end);
+
+    if (pw_flush(w) < 0) {
+        goto CLEANUP;
+    }
+    if (w->record_count > 0 && columns != 0) {
+        map = mmap(NULL, records_end, PROT_READ, MAP_SHARED, w->fd, 0);
+        if (map == MAP_FAILED) {
+            goto CLEANUP;
+        }
+        madvise(map, records_end, MADV_SEQUENTIAL);
+    }
+    for (size_t f = 0; f < NUM_FIELDS; f++) {
+        if (!(columns & fields[f].bit)) {
+            continue;
+        }
+        if (map != MAP_FAILED &&
+            write_column(w, (const Person *)((char *)map +
+                                             sizeof(PersonFileHeader)),
+                         f, offset) < 0) {
+            goto CLEANUP;
+        }
+        ColumnDesc *d = &descs[num_columns++];
+        memset(d, 0, sizeof(*d));
+        strncpy(d->name, fields[f].name, sizeof(d->name));
+        d->field_offset = htole32(fields[f].offset);
+        d->field_size = htole32(fields[f].size);
+        d->data_offset = htole64(offset);
+        offset = align_up(offset + w->record_count * fields[f].size);
+    }
+
+    uint64_t columns_offset = num_columns > 0 ? offset : 0;
+    if (num_columns > 0) {
+        if (write_all(w->fd, descs, num_columns * sizeof(ColumnDesc),
+                      offset) < 0) {
+            goto CLEANUP;
+        }
+        offset += num_columns * sizeof(ColumnDesc);
+    } else {
+        offset = records_end;
+    }
+    if (ftruncate(w->fd, offset) < 0) {
+        goto CLEANUP;
+    }
+
+    /* The header goes last, so the file only claims the new records once
+     * everything they depend on has been written. */
+    PersonFileHeader h;
+    if (pread(w->fd, &h, sizeof(h), 0) != sizeof(h)) {
+        errno = EIO;
+        goto CLEANUP;
+    }
+    h.record_count = htole64(w->record_count);
+    h.columns_offset = htole64(columns_offset);
+    h.num_columns = htole32(num_columns);
+    if (write_all(w->fd, &h, sizeof(h), 0) < 0) {
+        goto CLEANUP;
+    }
+    result = 0;
+
+CLEANUP:
+    if (map != MAP_FAILED) {
+        munmap(map, records_end);
+    }
+    int saved_errno = errno;
+    if (close(w->fd) < 0 && result == 0) {
+        saved_errno = errno;
+        result = -1;
+    }
+    free(w->buf);
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+    errno = saved_errno;
+    return result;
+}
+
+int pr_open(PersonReader *r, const char *path) {
+    memset(r, 0, sizeof(*r));
+    if (!host_is_little_endian()) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(PersonFileHeader)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    int saved_errno = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        errno = saved_errno;
+        return -1;
+    }
+
+    const PersonFileHeader *h = map;
+    if (check_header(h, st.st_size) < 0) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    r->map = map;
+    r->map_size = st.st_size;
+    r->header = h;
+    r->records = (const Person *)((const char *)map + h->records_offset);
+    r->record_count = h->record_count;
+    return 0;
+}
+
+const void *pr_column(const PersonReader *r, const char *name,
+                      uint32_t *field_size) {
+    const ColumnDesc *descs =
+        (const ColumnDesc *)((const char *)r->map + r->header->columns_offset);
+    for (uint32_t i = 0; i < r->header->num_columns; i++) {
+        const ColumnDesc *d = &descs[i];
+        if (strncmp(d->name, name, sizeof(d->name)) != 0) {
+            continue;
+        }
+        /* A block of the wrong width or alignment cannot be read as an
+         * array of the field's type, so treat it as missing. */
+        if (find_field(d) < 0 || d->data_offset > r->map_size ||
+            r->record_count > (r->map_size - d->data_offset) /
+                              d->field_size) {
+            return NULL;
+        }
+        *field_size = d->field_size;
+        return (const char *)r->map + d->data_offset;
+    }
+    return NULL;
+}
+
+void pr_close(PersonReader *r) {
+    if (r->map != NULL) {
+        munmap(r->map, r->map_size);
+    }
+    memset(r, 0, sizeof(*r));
+}
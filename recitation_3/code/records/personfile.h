@@ -0,0 +1,135 @@
+/*******************************************************************************
+ * Name        : personfile.h
+ * Description : A fixed-layout, versioned binary file of Person records that
+ *               can be used in place through mmap(), without parsing.
+ *
+ * File layout (every integer little-endian, every section 64-byte aligned):
+ *
+ *     offset 0                 PersonFileHeader (64 bytes)
+ *     records_offset           Person[record_count]
+ *     columns[i].data_offset   optional column blocks: one field of every
+ *                              record stored contiguously, e.g. all ages
+ *     columns_offset           ColumnDesc[num_columns]
+ *
+ * The records come right after the header so that appending only ever writes
+ * past the last record. Column blocks and their directory are rebuilt from the
+ * records whenever a writer is closed.
+ ******************************************************************************/
+#ifndef PERSONFILE_H
+#define PERSONFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PERSONFILE_MAGIC     "PREC"
+#define PERSONFILE_VERSION   1
+#define PERSONFILE_ALIGN     64
+#define PERSON_NAME_SIZE     20
+
+/*
+ * As struct-padding-walkthrough.md shows, the compiler inserts padding to
+ * align each member. The members here are ordered from largest to smallest
+ * alignment and sized so that there is no padding anywhere, which makes the
+ * layout the same for every compiler, and a Person never straddles a cache
+ * line.
+ */
+typedef struct Person {
+    uint64_t id;
+    int32_t  age;
+    char     name[PERSON_NAME_SIZE];    /* '\0'-padded, not always terminated */
+} Person;
+
+_Static_assert(sizeof(Person) == 32, "Person must be 32 bytes");
+_Static_assert(offsetof(Person, age) == 8, "unexpected padding in Person");
+_Static_assert(offsetof(Person, name) == 12, "unexpected padding in Person");
+
+typedef struct {
+    char     magic[4];
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t record_size;
+    uint32_t alignment;
+    uint64_t record_count;
+    uint64_t records_offset;
+    uint64_t columns_offset;
+    uint32_t num_columns;
+    uint32_t reserved;
+    uint8_t  padding[16];
+} PersonFileHeader;
+
+typedef struct {
+    char     name[16];
+    uint32_t field_offset;      /* of the field within a Person */
+    uint32_t field_size;
+    uint64_t data_offset;       /* of the column block in the file */
+    uint64_t reserved;
+} ColumnDesc;
+
+_Static_assert(sizeof(PersonFileHeader) == PERSONFILE_ALIGN,
+               "the header must fill exactly one aligned block");
+_Static_assert(sizeof(ColumnDesc) == 40, "unexpected padding in ColumnDesc");
+
+/* Bits for the columns argument of pw_close(). */
+#define PF_COLUMN_ID   0x1
+#define PF_COLUMN_AGE  0x2
+#define PF_COLUMN_NAME 0x4
+
+typedef struct {
+    int fd;
+    uint64_t record_count;
+    unsigned columns;       /* PF_COLUMN_* bits the file had when opened */
+    char *buf;
+    size_t used;
+} PersonWriter;
+
+typedef struct {
+    void *map;
+    size_t map_size;
+    const PersonFileHeader *header;
+    const Person *records;
+    uint64_t record_count;
+} PersonReader;
+
+/**
+ * Opens path for writing. If append is false, or path is missing or empty,
+ * the file is created or truncated. If append is true and path is a valid
+ * person file, new records are added after the existing ones and w->columns
+ * tells which column blocks it had; any other file fails with EINVAL and is
+ * left untouched. Returns 0 on success and -1 with errno set on error.
+ */
+int pw_open(PersonWriter *w, const char *path, bool append);
+
+/**
+ * Appends a record. Records are buffered and written in large blocks.
+ */
+int pw_append(PersonWriter *w, const Person *p);
+
+/**
+ * Writes out the buffered records, builds the column blocks selected by the
+ * PF_COLUMN_* bits in columns, writes the header and closes the file. Column
+ * blocks not selected are dropped; pass w->columns to keep the ones the file
+ * already had.
+ */
+int pw_close(PersonWriter *w, unsigned columns);
+
+/**
+ * Maps the file at path read-only. On success, r->records points straight
+ * into the mapping; nothing is copied or converted. Fails with EINVAL if the
+ * file is not a valid person file, and with ENOTSUP on big-endian hosts,
+ * where the records could not be used without conversion.
+ */
+int pr_open(PersonReader *r, const char *path);
+
+/**
+ * Returns the column block called name ("id", "age" or "name"), or NULL if
+ * the file does not have one or its descriptor does not match the field's
+ * size, offset and alignment. The block holds r->record_count values of
+ * *field_size bytes each, aligned to PERSONFILE_ALIGN.
+ */
+const void *pr_column(const PersonReader *r, const char *name,
+                      uint32_t *field_size);
+
+void pr_close(PersonReader *r);
+
+#endif
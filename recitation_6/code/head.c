@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include "iostats.h"
 
 #define BUFSIZE 16384
 #define DEFAULT_LINE_COUNT 10
@@ -75,6 +76,8 @@ void display_usage(char *progname) {
  * of a file.
  */
 int main(int argc, char *argv[]) {
+    IOSTATS_PHASE("parse");
+
     if (argc == 1) {
         display_usage(argv[0]);
         return EXIT_FAILURE;
@@ -128,6 +131,7 @@ int main(int argc, char *argv[]) {
      * "Error: Cannot open source file '%s': %s.\n"
      * The second %s should use strerror.
      */
+    IOSTATS_PHASE("open");
 
 
     printf("==> %s (%d line%s) <==\n", src_file, line_count,
@@ -137,10 +141,14 @@ int main(int argc, char *argv[]) {
     /* TODO - Use read() and write() to display the first n lines on the screen.
      * If n exceeds the line count of the file, display the whole file.
      * Do not use printf()!
+     * iostats_read() and iostats_write() behave exactly like read() and
+     * write(), and are also counted by head-stats --stats.
      */
+    IOSTATS_PHASE("copy");
 
 
     /* TODO - Close the file. Free up resources, if necessary. */
+    IOSTATS_PHASE("close");
 
 
     return EXIT_SUCCESS;
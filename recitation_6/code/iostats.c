@@ -0,0 +1,240 @@
+/*******************************************************************************
+ * Name        : iostats.c
+ * Description : Implementation of the --stats instrumentation in iostats.h.
+ *               Programs are linked with -Wl,--wrap=main, which makes the C
+ *               runtime call __wrap_main() below instead of main(), so the
+ *               utilities' own sources need no setup call.
+ ******************************************************************************/
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include "iostats.h"
+
+#define MAX_PHASES 16
+#define NUM_HW_COUNTERS 3
+
+bool iostats_enabled = false;
+
+static const char *progname;
+static uint64_t start_ns, phase_start_ns;
+static int current_phase;
+static int num_phases;
+static struct {
+    const char *name;
+    uint64_t ns;
+} phases[MAX_PHASES];
+
+static struct {
+    unsigned long calls;
+    unsigned long bytes;
+} counters[IOSTATS_NUM_COUNTERS];
+
+static const struct {
+    const char *name;
+    uint64_t config;
+} hw_counters[NUM_HW_COUNTERS] = {
+    { "cycles",       PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_COUNT_HW_INSTRUCTIONS },
+    { "cache_misses", PERF_COUNT_HW_CACHE_MISSES },
+};
+static int hw_fds[NUM_HW_COUNTERS] = { -1, -1, -1 };
+
+/*
+ * glibc's start-up code calls main() as main(argc, argv, envp) whatever its
+ * declared parameters are; the wrapper does the same.
+ */
+int __real_main(int argc, char **argv, char **envp);
+int __wrap_main(int argc, char **argv, char **envp);
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint64_t timeval_ns(struct timeval tv) {
+    return (uint64_t)tv.tv_sec * 1000000000u + (uint64_t)tv.tv_usec * 1000u;
+}
+
+/**
+ * Opens the hardware counters as one group led by the cycle counter, so they
+ * are scheduled onto the PMU together and can be read with a single read().
+ * Only user space is counted, which is what an unprivileged process is
+ * allowed to measure with the default perf_event_paranoid setting.
+ */
+static void open_hw_counters(void) {
+    for (int i = 0; i < NUM_HW_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = hw_counters[i].config;
+        attr.disabled = i == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        hw_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1,
+                            i == 0 ? -1 : hw_fds[0], 0);
+        if (i == 0 && hw_fds[0] < 0) {
+            return;
+        }
+    }
+    ioctl(hw_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static ssize_t counting_read(void *cookie, char *buf, size_t size) {
+    return iostats_read(*(int *)cookie, buf, size);
+}
+
+static ssize_t counting_write(void *cookie, const char *buf, size_t size) {
+    return iostats_write(*(int *)cookie, buf, size);
+}
+
+/**
+ * Returns a stream on fd whose buffer is filled and flushed by the counting
+ * functions above, buffered the way glibc would buffer fd itself: by line for
+ * a terminal, and otherwise in blocks of the file's st_blksize. Returns fp
+ * unchanged if the stream cannot be created.
+ */
+static FILE *counting_stream(FILE *fp, int *fd, const char *mode) {
+    cookie_io_functions_t io = { .read = counting_read,
+                                 .write = counting_write };
+    FILE *counted = fopencookie(fd, mode, io);
+    if (counted == NULL) {
+        return fp;
+    }
+    struct stat st;
+    size_t size = fstat(*fd, &st) == 0 && st.st_blksize > 0 ?
+                  (size_t)st.st_blksize : BUFSIZ;
+    setvbuf(counted, NULL, isatty(*fd) ? _IOLBF : _IOFBF, size);
+    return counted;
+}
+
+static void report(void) {
+    /* exit() flushes stdio only after the atexit() handlers have run. */
+    fflush(stdout);
+    iostats_phase_switch(NULL);
+    uint64_t wall_ns = now_ns() - start_ns;
+
+    /* With PERF_FORMAT_GROUP, values come in the order the counters were
+     * added to the group, skipping any that failed to open. */
+    uint64_t group[1 + NUM_HW_COUNTERS];
+    bool have_hw = false;
+    if (hw_fds[0] >= 0) {
+        ioctl(hw_fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        have_hw = read(hw_fds[0], group, sizeof(group)) > 0;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(stderr, "{\"program\": \"");
+    for (const char *p = progname; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', stderr);
+        }
+        fputc(*p, stderr);
+    }
+    fprintf(stderr, "\", \"wall_ns\": %lu, \"user_ns\": %lu, "
+            "\"sys_ns\": %lu, \"phases\": {", (unsigned long)wall_ns,
+            (unsigned long)timeval_ns(usage.ru_utime),
+            (unsigned long)timeval_ns(usage.ru_stime));
+    for (int i = 0; i < num_phases; i++) {
+        fprintf(stderr, "%s\"%s\": %lu", i ? ", " : "", phases[i].name,
+                (unsigned long)phases[i].ns);
+    }
+    fprintf(stderr, "}, \"syscalls\": {\"read\": %lu, \"write\": %lu, "
+            "\"bytes_read\": %lu, \"bytes_written\": %lu}, \"hw\": ",
+            counters[IOSTATS_SYS_READ].calls,
+            counters[IOSTATS_SYS_WRITE].calls,
+            counters[IOSTATS_SYS_READ].bytes,
+            counters[IOSTATS_SYS_WRITE].bytes);
+    if (have_hw) {
+        fprintf(stderr, "{");
+        for (int i = 0, v = 1; i < NUM_HW_COUNTERS; i++) {
+            fprintf(stderr, "%s\"%s\": ", i ? ", " : "", hw_counters[i].name);
+            if (hw_fds[i] >= 0 && (uint64_t)v <= group[0]) {
+                fprintf(stderr, "%lu", (unsigned long)group[v++]);
+            } else {
+                fprintf(stderr, "null");
+            }
+        }
+        fprintf(stderr, "}}\n");
+    } else {
+        fprintf(stderr, "null}\n");
+    }
+}
+
+/**
+ * Removes every "--stats" argument from argv, adjusting *argc, and if there
+ * was one, turns on instrumentation, routes stdin and stdout through counting
+ * streams and registers the report with atexit().
+ */
+static void iostats_init(int *argc, char **argv) {
+    int kept = 0;
+    for (int i = 0; i < *argc; i++) {
+        if (i > 0 && strcmp(argv[i], "--stats") == 0) {
+            iostats_enabled = true;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argv[kept] = NULL;
+    *argc = kept;
+    if (!iostats_enabled) {
+        return;
+    }
+
+    const char *slash = strrchr(argv[0], '/');
+    progname = slash ? slash + 1 : argv[0];
+    start_ns = phase_start_ns = now_ns();
+    phases[0].name = "main";
+    num_phases = 1;
+    current_phase = 0;
+    static int stdin_fd = STDIN_FILENO, stdout_fd = STDOUT_FILENO;
+    stdin = counting_stream(stdin, &stdin_fd, "r");
+    stdout = counting_stream(stdout, &stdout_fd, "w");
+    open_hw_counters();
+    atexit(report);
+}
+
+int __wrap_main(int argc, char **argv, char **envp) {
+    iostats_init(&argc, argv);
+    return __real_main(argc, argv, envp);
+}
+
+void iostats_phase_switch(const char *name) {
+    uint64_t now = now_ns();
+    if (current_phase >= 0) {
+        phases[current_phase].ns += now - phase_start_ns;
+    }
+    phase_start_ns = now;
+    current_phase = -1;
+    if (name == NULL) {
+        return;
+    }
+    for (int i = 0; i < num_phases; i++) {
+        if (strcmp(phases[i].name, name) == 0) {
+            current_phase = i;
+            return;
+        }
+    }
+    if (num_phases < MAX_PHASES) {
+        phases[num_phases].name = name;
+        phases[num_phases].ns = 0;
+        current_phase = num_phases++;
+    }
+}
+
+void iostats_add(IostatsCounter counter, long bytes) {
+    counters[counter].calls++;
+    counters[counter].bytes += bytes;
+}
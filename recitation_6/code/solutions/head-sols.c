@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include "../iostats.h"
 
 #define BUFSIZE 16384
 #define DEFAULT_LINE_COUNT 10
@@ -75,6 +76,8 @@ void display_usage(char *progname) {
  * of a file.
  */
 int main(int argc, char *argv[]) {
+    IOSTATS_PHASE("parse");
+
     if (argc == 1) {
         display_usage(argv[0]);
         return EXIT_FAILURE;
@@ -128,6 +131,7 @@ int main(int argc, char *argv[]) {
      * "Error: Cannot open source file '%s': %s.\n"
      * The second %s should use strerror.
      */
+    IOSTATS_PHASE("open");
     int src_fd;
     if ((src_fd = open(src_file, O_RDONLY)) == -1) {
         fprintf(stderr, "Error: Cannot open source file '%s': %s.\n",
@@ -142,13 +146,16 @@ int main(int argc, char *argv[]) {
     /* TODO - Use read() and write() to display the first n lines on the screen.
      * If n exceeds the line count of the file, display the whole file.
      * Do not use printf()!
+     * iostats_read() and iostats_write() behave exactly like read() and
+     * write(), and are also counted by head-sols-stats --stats.
      */
+    IOSTATS_PHASE("copy");
     char buf[BUFSIZE];
     int num_lines = 0, bytes_read;
     bool done = line_count == 0;
-    while (!done && (bytes_read = read(src_fd, buf, BUFSIZE)) > 0) {
+    while (!done && (bytes_read = iostats_read(src_fd, buf, BUFSIZE)) > 0) {
         for (int i = 0; i < bytes_read; i++) {
-            if (write(STDOUT_FILENO, buf + i, 1) < 0) {
+            if (iostats_write(STDOUT_FILENO, buf + i, 1) < 0) {
                 fprintf(stderr, "Error: Write failed. Output incomplete.\n");
                 goto CLEANUP_FAILURE;
             }
@@ -163,6 +170,7 @@ int main(int argc, char *argv[]) {
     }
 
     /* TODO - Close the file. Free up resources, if necessary. */
+    IOSTATS_PHASE("close");
     close(src_fd);
     return EXIT_SUCCESS;
 
@@ -0,0 +1,195 @@
+/*******************************************************************************
+ * Name        : bufwriter.c
+ * Description : Implementation of the fork-aware buffered writer in
+ *               bufwriter.h.
+ ******************************************************************************/
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "bufwriter.h"
+
+/*
+ * Lock order: writers_lock first, then a writer's own lock. Only code that
+ * walks the list takes both.
+ */
+static pthread_mutex_t writers_lock = PTHREAD_MUTEX_INITIALIZER;
+static BufWriter *writers;
+static pthread_once_t registered = PTHREAD_ONCE_INIT;
+
+/**
+ * Writes all of data, retrying after short writes and signals. A single
+ * write() of at most PIPE_BUF bytes to a pipe is never short, so the loop only
+ * matters for oversized records and for regular files on full disks.
+ */
+static int write_fully(BufWriter *w, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(w->fd, data, len);
+        w->writes++;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* The functions below ending in _locked expect w->lock to be held. */
+
+static int flush_locked(BufWriter *w) {
+    if (w->len == 0) {
+        return 0;
+    }
+    /* Empty the buffer even on failure, so the data is never written twice. */
+    int result = write_fully(w, w->buf, w->len);
+    w->len = 0;
+    return result;
+}
+
+static int write_locked(BufWriter *w, const void *data, size_t len) {
+    /* Keep records whole: if this one does not fit after what is already
+     * buffered, send the buffer out first. */
+    if (w->len + len > sizeof(w->buf) && flush_locked(w) < 0) {
+        return -1;
+    }
+    if (len > sizeof(w->buf)) {
+        return write_fully(w, data, len);
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+    return w->mode == BW_LINE ? flush_locked(w) : 0;
+}
+
+static void register_handlers(void) {
+    pthread_atfork(bw_atfork_prepare, bw_atfork_parent, bw_atfork_child);
+    atexit(bw_flush_all);
+}
+
+void bw_init(BufWriter *w, int fd, BwMode mode) {
+    if (mode == BW_AUTO) {
+        mode = isatty(fd) ? BW_LINE : BW_FULL;
+    }
+    w->fd = fd;
+    w->mode = mode;
+    w->len = 0;
+    w->writes = 0;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_once(&registered, register_handlers);
+
+    pthread_mutex_lock(&writers_lock);
+    w->next = writers;
+    writers = w;
+    pthread_mutex_unlock(&writers_lock);
+}
+
+int bw_close(BufWriter *w) {
+    int result = bw_flush(w);
+    pthread_mutex_lock(&writers_lock);
+    for (BufWriter **p = &writers; *p != NULL; p = &(*p)->next) {
+        if (*p == w) {
+            *p = w->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&writers_lock);
+    pthread_mutex_destroy(&w->lock);
+    return result;
+}
+
+int bw_flush(BufWriter *w) {
+    pthread_mutex_lock(&w->lock);
+    int result = flush_locked(w);
+    pthread_mutex_unlock(&w->lock);
+    return result;
+}
+
+void bw_flush_all(void) {
+    pthread_mutex_lock(&writers_lock);
+    for (BufWriter *w = writers; w != NULL; w = w->next) {
+        bw_flush(w);
+    }
+    pthread_mutex_unlock(&writers_lock);
+}
+
+int bw_write(BufWriter *w, const void *data, size_t len) {
+    pthread_mutex_lock(&w->lock);
+    int result = write_locked(w, data, len);
+    pthread_mutex_unlock(&w->lock);
+    return result;
+}
+
+int bw_printf(BufWriter *w, const char *format, ...) {
+    va_list args;
+    int result;
+
+    pthread_mutex_lock(&w->lock);
+    size_t room = sizeof(w->buf) - w->len;
+
+    /* Format straight into the buffer when the record fits, which is the
+     * common case and needs no copy. */
+    va_start(args, format);
+    int n = vsnprintf(w->buf + w->len, room, format, args);
+    va_end(args);
+    if (n < 0) {
+        result = -1;
+    } else if ((size_t)n < room) {
+        w->len += n;
+        result = w->mode == BW_LINE ? flush_locked(w) : 0;
+    } else {
+        /* vsnprintf() clobbered the free space, but the buffered records
+         * before it are intact. Format the record on its own and add it
+         * whole. */
+        char *record = malloc((size_t)n + 1);
+        if (record == NULL) {
+            result = -1;
+        } else {
+            va_start(args, format);
+            vsnprintf(record, (size_t)n + 1, format, args);
+            va_end(args);
+            result = write_locked(w, record, n);
+            free(record);
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    return result;
+}
+
+/*
+ * The standard pthread_atfork() pattern: take every lock before fork(), so
+ * no other thread is inside a writer at that moment, and release them on both
+ * sides afterwards. The child is a copy of the forking thread, which holds
+ * the locks, so it may unlock them.
+ */
+void bw_atfork_prepare(void) {
+    pthread_mutex_lock(&writers_lock);
+    for (BufWriter *w = writers; w != NULL; w = w->next) {
+        pthread_mutex_lock(&w->lock);
+        flush_locked(w);
+    }
+}
+
+void bw_atfork_parent(void) {
+    for (BufWriter *w = writers; w != NULL; w = w->next) {
+        pthread_mutex_unlock(&w->lock);
+    }
+    pthread_mutex_unlock(&writers_lock);
+}
+
+void bw_atfork_child(void) {
+    /* bw_atfork_prepare() already emptied every buffer; if a write() failed
+     * there, dropping the data here keeps the child from repeating it. */
+    for (BufWriter *w = writers; w != NULL; w = w->next) {
+        w->len = 0;
+        w->writes = 0;
+        pthread_mutex_unlock(&w->lock);
+    }
+    pthread_mutex_unlock(&writers_lock);
+}
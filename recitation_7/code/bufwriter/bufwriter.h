@@ -0,0 +1,83 @@
+/*******************************************************************************
+ * Name        : bufwriter.h
+ * Description : A small output buffer that stays correct across fork().
+ *
+ *               stdio copies its buffer into the child on fork(), so any line
+ *               still sitting in the parent's buffer is printed twice: once
+ *               by the parent and once by the child. A BufWriter instead
+ *               flushes every writer before fork() (see bw_atfork_prepare()),
+ *               so a child always starts with an empty buffer.
+ *
+ *               Each bw_write() or bw_printf() call is a record that is never
+ *               split between two write() calls as long as it is at most
+ *               PIPE_BUF bytes, and the buffer itself holds at most PIPE_BUF
+ *               bytes. Since POSIX makes write()s of up to PIPE_BUF bytes to
+ *               a pipe atomic, records from different processes sharing a
+ *               pipe never interleave mid-line.
+ *
+ *               Every call locks the writer, so threads may share one, and
+ *               bw_atfork_prepare() takes every writer's lock before it
+ *               flushes. A fork() from one thread therefore never catches
+ *               another thread halfway through adding a record.
+ ******************************************************************************/
+#ifndef BUFWRITER_H
+#define BUFWRITER_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+
+typedef enum {
+    BW_AUTO,    /* BW_LINE if the fd is a terminal, BW_FULL otherwise */
+    BW_LINE,    /* write out every record right away */
+    BW_FULL     /* write out only when the next record does not fit */
+} BwMode;
+
+typedef struct BufWriter {
+    int fd;
+    BwMode mode;
+    size_t len;
+    unsigned long writes;       /* write() calls made so far */
+    struct BufWriter *next;     /* all writers, for bw_flush_all() */
+    pthread_mutex_t lock;       /* held while the buffer is being changed */
+    char buf[PIPE_BUF];
+} BufWriter;
+
+/**
+ * Sets up w to write to fd and registers it so that it is flushed before
+ * every fork() and at exit(). The first call registers the fork handlers
+ * with pthread_atfork() and bw_flush_all() with atexit().
+ */
+void bw_init(BufWriter *w, int fd, BwMode mode);
+
+/**
+ * Flushes w and unregisters it. Does not close fd. No other thread may be
+ * using w.
+ */
+int bw_close(BufWriter *w);
+
+/**
+ * Appends the record data[0..len) to the buffer. Returns 0 on success and -1
+ * with errno set if a write() failed.
+ */
+int bw_write(BufWriter *w, const void *data, size_t len);
+
+/**
+ * Formats a record like printf() and appends it to the buffer.
+ */
+int bw_printf(BufWriter *w, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+int bw_flush(BufWriter *w);
+void bw_flush_all(void);
+
+/*
+ * The handlers bw_init() registers with pthread_atfork(). They are exposed
+ * for programs that fork through something other than fork(), e.g. a raw
+ * clone() or vfork(), and have to call them by hand.
+ */
+void bw_atfork_prepare(void);
+void bw_atfork_parent(void);
+void bw_atfork_child(void);
+
+#endif
@@ -0,0 +1,246 @@
+/*******************************************************************************
+ * Name        : bw_bench.c
+ * Description : Compares BufWriter with stdio in two ways:
+ *               1. Throughput: write -n lines to a file (/dev/null by
+ *                  default) and count the lines per second and write()
+ *                  calls each one makes.
+ *               2. Correctness across fork(): buffer one line, fork -c
+ *                  children that each write -l lines to the same O_APPEND
+ *                  file, and check that every expected line appears exactly
+ *                  once and no line was torn.
+ ******************************************************************************/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "bufwriter.h"
+
+static unsigned long stdio_writes;
+
+double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* A FILE * whose buffer flushes land here, so we can count them. */
+ssize_t counting_write(void *cookie, const char *buf, size_t size) {
+    stdio_writes++;
+    return write(*(int *)cookie, buf, size);
+}
+
+FILE *counting_fdopen(int *fd) {
+    cookie_io_functions_t io = { .write = counting_write };
+    FILE *fp = fopencookie(fd, "w", io);
+    if (fp != NULL) {
+        setvbuf(fp, NULL, _IOFBF, BUFSIZ);
+    }
+    return fp;
+}
+
+void throughput(const char *path, long lines) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open '%s'. %s.\n", path,
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    struct timespec start;
+    double secs;
+
+    printf("Writing %ld lines to %s:\n", lines, path);
+
+    FILE *fp = counting_fdopen(&fd);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < lines; i++) {
+        fprintf(fp, "line %ld of the benchmark\n", i);
+    }
+    fclose(fp);
+    secs = seconds_since(&start);
+    printf("    %-22s %7.3f s  %10.0f lines/s  %8lu write() calls\n",
+           "stdio fprintf:", secs, lines / secs, stdio_writes);
+
+    BufWriter w;
+    bw_init(&w, fd, BW_FULL);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < lines; i++) {
+        bw_printf(&w, "line %ld of the benchmark\n", i);
+    }
+    bw_flush(&w);
+    secs = seconds_since(&start);
+    printf("    %-22s %7.3f s  %10.0f lines/s  %8lu write() calls\n",
+           "BufWriter bw_printf:", secs, lines / secs, w.writes);
+
+    static const char line[] = "a line of the benchmark\n";
+    w.writes = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < lines; i++) {
+        bw_write(&w, line, sizeof(line) - 1);
+    }
+    bw_flush(&w);
+    secs = seconds_since(&start);
+    printf("    %-22s %7.3f s  %10.0f lines/s  %8lu write() calls\n",
+           "BufWriter bw_write:", secs, lines / secs, w.writes);
+
+    bw_close(&w);
+    close(fd);
+}
+
+/**
+ * Forks children that all write to fd after the parent has buffered one
+ * line, using stdio or a BufWriter, and waits for them.
+ */
+void fork_writers(int fd, bool use_bw, int children, long lines) {
+    int out = fd;
+    FILE *fp = NULL;
+    BufWriter w;
+
+    /* Our own report goes through stdout, which has exactly the problem
+     * being measured; empty it so the children do not print it again. */
+    fflush(stdout);
+
+    if (use_bw) {
+        bw_init(&w, fd, BW_FULL);
+        bw_printf(&w, "parent %d before fork\n", getpid());
+    } else {
+        fp = counting_fdopen(&out);
+        fprintf(fp, "parent %d before fork\n", getpid());
+    }
+
+    for (int c = 0; c < children; c++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            exit(EXIT_FAILURE);
+        }
+        if (pid == 0) {
+            for (long i = 0; i < lines; i++) {
+                if (use_bw) {
+                    bw_printf(&w, "child %d line %ld\n", c, i);
+                } else {
+                    fprintf(fp, "child %d line %ld\n", c, i);
+                }
+            }
+            exit(EXIT_SUCCESS);     /* flushes stdio or the BufWriter */
+        }
+    }
+    while (wait(NULL) > 0) {
+    }
+    if (use_bw) {
+        bw_close(&w);
+    } else {
+        fclose(fp);
+    }
+}
+
+/**
+ * Reads back what fork_writers() produced and reports duplicated, missing
+ * and malformed lines.
+ */
+bool verify(const char *path, int children, long lines) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return false;
+    }
+    unsigned char *seen = calloc((size_t)children * lines, 1);
+    long parent = 0, dupes = 0, torn = 0, total = 0;
+    char buf[256];
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        int c, pid;
+        long i;
+        char end;
+        total++;
+        if (sscanf(buf, "parent %d before fork%c", &pid, &end) == 2 &&
+            end == '\n') {
+            parent++;
+        } else if (sscanf(buf, "child %d line %ld%c", &c, &i, &end) == 3 &&
+                   end == '\n' && c >= 0 && c < children && i >= 0 &&
+                   i < lines) {
+            if (seen[(size_t)c * lines + i]++) {
+                dupes++;
+            }
+        } else {
+            torn++;
+        }
+    }
+    long missing = 0;
+    for (size_t k = 0; k < (size_t)children * lines; k++) {
+        missing += seen[k] == 0;
+    }
+    fclose(fp);
+    free(seen);
+
+    dupes += parent > 1 ? parent - 1 : 0;
+    printf("%ld lines, parent line %ld time%s, %ld duplicated, %ld missing, "
+           "%ld torn\n", total, parent, parent == 1 ? "" : "s", dupes,
+           missing, torn);
+    return parent == 1 && dupes == 0 && missing == 0 && torn == 0;
+}
+
+void display_usage(char *progname) {
+    fprintf(stderr, "Usage: %s [-n lines] [-o output] [-c children] "
+            "[-l lines_per_child]\n", progname);
+}
+
+int main(int argc, char *argv[]) {
+    long lines = 1000000, child_lines = 10000;
+    int children = 8, opt;
+    char *output = "/dev/null";
+    opterr = 0;
+
+    while ((opt = getopt(argc, argv, ":n:o:c:l:")) != -1) {
+        switch (opt) {
+            case 'n':
+                lines = atol(optarg);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'c':
+                children = atoi(optarg);
+                break;
+            case 'l':
+                child_lines = atol(optarg);
+                break;
+            default:
+                display_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (lines < 1 || children < 1 || child_lines < 1) {
+        display_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    throughput(output, lines);
+
+    char path[] = "/tmp/bw_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    bool ok = true;
+    printf("\n%d children writing %ld lines each after the parent buffered "
+           "one line:\n", children, child_lines);
+    for (int use_bw = 0; use_bw <= 1; use_bw++) {
+        fd = open(path, O_WRONLY | O_TRUNC | O_APPEND);
+        fork_writers(fd, use_bw, children, child_lines);
+        close(fd);
+        printf("    %-11s ", use_bw ? "BufWriter:" : "stdio:");
+        bool clean = verify(path, children, child_lines);
+        /* stdio is expected to repeat the parent's line; that is the bug. */
+        ok = ok && (!use_bw || clean);
+    }
+    unlink(path);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -2,27 +2,40 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+// Building with -D BUFWRITER (make modern_family-bw) prints through a
+// BufWriter from ../bufwriter instead of stdio.
+#ifdef BUFWRITER
+#include "bufwriter.h"
+static BufWriter out;
+#define SAY(s)  bw_printf(&out, "%s\n", s)
+#else
+#define SAY(s)  printf("%s\n", s)
+#endif
+
 int main()
 {
     int i;
     pid_t p;
 
+#ifdef BUFWRITER
+    bw_init(&out, STDOUT_FILENO, BW_AUTO);
+#endif
     p = fork();
 
     if (p > 0) {
         for (i = 0; i < 10; i++) {
-            printf("Listen to me\n");
+            SAY("Listen to me");
             sleep(1);
         }
-        printf("I give up...\n");
+        SAY("I give up...");
         return 0;
     }
     else if (p == 0) {
         for (i = 0; i < 10; i++) {
-            printf("No way\n");
+            SAY("No way");
             sleep(1);
         }
-        printf("Whatever.\n");
+        SAY("Whatever.");
         return 1;
     }
     else {
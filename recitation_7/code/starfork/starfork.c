@@ -7,6 +7,20 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
+// Building with -D BUFWRITER prints through a BufWriter (see ../bufwriter)
+// instead of stdio. It is flushed before every fork(), so no child inherits
+// lines its parent has not written out yet, and the output is the same
+// whether or not stdout is a terminal.
+#ifdef BUFWRITER
+#include "bufwriter.h"
+static BufWriter out;
+#define PRINT_LINE(s)   bw_printf(&out, "%s\n", s)
+#define BEFORE_EXEC()   bw_flush_all()
+#else
+#define PRINT_LINE(s)   printf("%s\n", s)
+#define BEFORE_EXEC()
+#endif
+
 static void exit_report(void) {
     fprintf(stderr, "Process [%d] finished.\n", getpid());
 }
@@ -29,7 +43,7 @@ void star(int numstar) {
     while (0 <= --numstar)
         line[numstar] = star;
 
-    printf("%s\n", line);
+    PRINT_LINE(line);
 }
 
 int main(int argc, char **argv)
@@ -40,6 +54,10 @@ int main(int argc, char **argv)
     if (atexit(exit_report) != 0)
         perror("Can't register exit function");
 
+#ifdef BUFWRITER
+    bw_init(&out, STDOUT_FILENO, BW_AUTO);
+#endif
+
     for (int i = 1; i <= n; i++) {
 
         // You can enable each code block below by defining S1, S2, etc.
@@ -88,6 +106,7 @@ int main(int argc, char **argv)
         star(i);
         sleep(1);
         char *a[] = { argv[0], argv[1], NULL };
+        BEFORE_EXEC();
         execv(*a, a);
         printf("%s\n", "A STAR IS BORN");
         exit(EXIT_SUCCESS);
@@ -100,6 +119,7 @@ int main(int argc, char **argv)
             char buf[100];
             sprintf(buf, "%d", 2 * n);
             char *a[] = { argv[0], buf, NULL };
+            BEFORE_EXEC();
             execv(*a, a);
         }
         waitpid(pid, NULL, 0); // no status, no options
@@ -0,0 +1,33 @@
+#!/bin/bash
+###############################################################################
+# Name: bench.sh
+# Builds a tree of roughly a million empty files (1000 directories with 1000
+# files each, spread over two levels) and compares find against fastscan
+# with different thread counts. Pass a directory to reuse an existing tree.
+###############################################################################
+
+readonly TREE="${1:-/tmp/fastscan_tree}"
+
+make_tree() {
+    echo "Creating $TREE."
+    for a in $(seq 1 10); do
+        for b in $(seq 1 100); do
+            local dir="$TREE/d$a/d$b"
+            mkdir -p "$dir"
+            (cd "$dir" && seq 1 1000 | xargs touch)
+        done
+    done
+}
+
+[ -d "$TREE" ] || make_tree
+
+echo "find -printf:"
+time find "$TREE" -mindepth 1 -printf '%M %p\n' > /dev/null
+
+for threads in 1 2 4 8 16 32; do
+    echo "fastscan -j $threads:"
+    time ./fastscan -j "$threads" "$TREE" > /dev/null
+done
+
+echo "fastscan -q (d_type only, no stat calls):"
+./fastscan -q "$TREE"
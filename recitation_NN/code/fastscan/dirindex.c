@@ -0,0 +1,283 @@
+/*******************************************************************************
+ * Name        : dirindex.c
+ * Description : Reading, building and writing the directory index described
+ *               in dirindex.h.
+ ******************************************************************************/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "dirindex.h"
+
+#define BYTE_ORDER_MARK 0x01020304u
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *p = realloc(ptr, size);
+    if (p == NULL) {
+        fprintf(stderr, "Error: malloc failed. %s.\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+int dirindex_open(DirIndex *idx, const char *path) {
+    memset(idx, 0, sizeof(*idx));
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(IndexHeader)) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    /* Check that every section lies inside the file before trusting it. */
+    const IndexHeader *h = map;
+    size_t size = st.st_size;
+    if (memcmp(h->magic, DIRINDEX_MAGIC, sizeof(DIRINDEX_MAGIC)) != 0 ||
+        h->version != DIRINDEX_VERSION || h->byte_order != BYTE_ORDER_MARK ||
+        h->dirs_off > size ||
+        h->num_dirs > (size - h->dirs_off) / sizeof(IndexDir) ||
+        h->entries_off > size ||
+        h->num_entries > (size - h->entries_off) / sizeof(IndexEntry) ||
+        h->strings_off > size || h->strings_size > size - h->strings_off ||
+        (h->strings_size > 0 &&
+         ((const char *)map)[h->strings_off + h->strings_size - 1] != '\0')) {
+        munmap(map, size);
+        return -1;
+    }
+
+    idx->map = map;
+    idx->map_size = size;
+    idx->header = h;
+    idx->dirs = (const IndexDir *)((const char *)map + h->dirs_off);
+    idx->entries = (const IndexEntry *)((const char *)map + h->entries_off);
+    idx->strings = (const char *)map + h->strings_off;
+    return 0;
+}
+
+void dirindex_close(DirIndex *idx) {
+    if (idx->map != NULL) {
+        munmap(idx->map, idx->map_size);
+    }
+    memset(idx, 0, sizeof(*idx));
+}
+
+const IndexDir *dirindex_find(const DirIndex *idx, const char *path) {
+    if (idx->header == NULL) {
+        return NULL;
+    }
+    size_t lo = 0, hi = idx->header->num_dirs;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const IndexDir *dir = &idx->dirs[mid];
+        if (dir->path_off >= idx->header->strings_size) {
+            return NULL;
+        }
+        int cmp = strcmp(path, dirindex_string(idx, dir->path_off));
+        if (cmp == 0) {
+            if (dir->first_entry > idx->header->num_entries ||
+                dir->num_entries >
+                    idx->header->num_entries - dir->first_entry) {
+                return NULL;
+            }
+            /* The string table ends in '\0', so a name that starts inside
+             * it also ends inside it. */
+            const IndexEntry *entries = idx->entries + dir->first_entry;
+            for (uint32_t i = 0; i < dir->num_entries; i++) {
+                if (entries[i].name_off >= idx->header->strings_size) {
+                    return NULL;
+                }
+            }
+            return dir;
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+bool dirindex_fresh(const IndexDir *dir, const struct stat *st) {
+    return dir->ino == (uint64_t)st->st_ino &&
+           dir->mtime_sec == (int64_t)st->st_mtim.tv_sec &&
+           dir->mtime_nsec == (uint32_t)st->st_mtim.tv_nsec;
+}
+
+static uint64_t builder_add_string(IndexBuilder *b, const char *s) {
+    size_t len = strlen(s) + 1;
+    if (b->strings_size + len > b->strings_cap) {
+        b->strings_cap = b->strings_cap ? b->strings_cap * 2 : 65536;
+        while (b->strings_size + len > b->strings_cap) {
+            b->strings_cap *= 2;
+        }
+        b->strings = xrealloc(b->strings, b->strings_cap);
+    }
+    uint64_t off = b->strings_size;
+    memcpy(b->strings + off, s, len);
+    b->strings_size += len;
+    return off;
+}
+
+void builder_begin_dir(IndexBuilder *b, const char *path,
+                       const struct stat *st, bool racy) {
+    if (b->num_dirs == b->dirs_cap) {
+        b->dirs_cap = b->dirs_cap ? b->dirs_cap * 2 : 256;
+        b->dirs = xrealloc(b->dirs, b->dirs_cap * sizeof(IndexDir));
+    }
+    IndexDir *dir = &b->dirs[b->num_dirs++];
+    dir->path_off = builder_add_string(b, path);
+    dir->first_entry = b->num_entries;
+    dir->ino = st->st_ino;
+    dir->mtime_sec = st->st_mtim.tv_sec;
+    dir->mtime_nsec = racy ? DIRINDEX_RACY_NSEC : st->st_mtim.tv_nsec;
+    dir->num_entries = 0;
+}
+
+static IndexEntry *builder_new_entry(IndexBuilder *b) {
+    if (b->num_entries == b->entries_cap) {
+        b->entries_cap = b->entries_cap ? b->entries_cap * 2 : 4096;
+        b->entries = xrealloc(b->entries, b->entries_cap * sizeof(IndexEntry));
+    }
+    b->dirs[b->num_dirs - 1].num_entries++;
+    return &b->entries[b->num_entries++];
+}
+
+void builder_add_entry(IndexBuilder *b, const char *name,
+                       const struct stat *st) {
+    uint64_t name_off = builder_add_string(b, name);
+    IndexEntry *e = builder_new_entry(b);
+    e->name_off = name_off;
+    e->size = st->st_size;
+    e->mtime_sec = st->st_mtim.tv_sec;
+    e->mtime_nsec = st->st_mtim.tv_nsec;
+    e->mode = st->st_mode;
+    e->uid = st->st_uid;
+    e->gid = st->st_gid;
+}
+
+void builder_mark_incomplete(IndexBuilder *b) {
+    b->dirs[b->num_dirs - 1].mtime_nsec = DIRINDEX_RACY_NSEC;
+}
+
+void builder_copy_entry(IndexBuilder *b, const DirIndex *idx,
+                        const IndexEntry *entry) {
+    uint64_t name_off =
+        builder_add_string(b, dirindex_string(idx, entry->name_off));
+    IndexEntry *e = builder_new_entry(b);
+    *e = *entry;
+    e->name_off = name_off;
+}
+
+void builder_free(IndexBuilder *b) {
+    free(b->dirs);
+    free(b->entries);
+    free(b->strings);
+    memset(b, 0, sizeof(*b));
+}
+
+typedef struct {
+    const char *path;
+    const IndexDir *dir;
+    uint64_t strings_base;
+    const IndexEntry *entries;
+} DirRef;
+
+static int compare_dir_refs(const void *a, const void *b) {
+    return strcmp(((const DirRef *)a)->path, ((const DirRef *)b)->path);
+}
+
+int dirindex_write(const char *path, IndexBuilder *builders, int count) {
+    size_t num_dirs = 0;
+    IndexHeader h = { .magic = DIRINDEX_MAGIC,
+                      .version = DIRINDEX_VERSION,
+                      .byte_order = BYTE_ORDER_MARK };
+    for (int i = 0; i < count; i++) {
+        num_dirs += builders[i].num_dirs;
+        h.num_entries += builders[i].num_entries;
+        h.strings_size += builders[i].strings_size;
+    }
+    h.num_dirs = num_dirs;
+    h.dirs_off = sizeof(IndexHeader);
+    h.entries_off = h.dirs_off + num_dirs * sizeof(IndexDir);
+    h.strings_off = h.entries_off + h.num_entries * sizeof(IndexEntry);
+
+    /* Sort every builder's directories by path, keeping track of where
+     * each builder's strings will land in the merged string table. */
+    DirRef *refs = xrealloc(NULL, (num_dirs ? num_dirs : 1) * sizeof(DirRef));
+    size_t n = 0;
+    uint64_t base = 0;
+    for (int i = 0; i < count; i++) {
+        IndexBuilder *b = &builders[i];
+        for (size_t d = 0; d < b->num_dirs; d++) {
+            refs[n].path = b->strings + b->dirs[d].path_off;
+            refs[n].dir = &b->dirs[d];
+            refs[n].strings_base = base;
+            refs[n].entries = b->entries + b->dirs[d].first_entry;
+            n++;
+        }
+        base += b->strings_size;
+    }
+    qsort(refs, num_dirs, sizeof(DirRef), compare_dir_refs);
+
+    size_t tmp_len = strlen(path) + 5;
+    char *tmp_path = xrealloc(NULL, tmp_len);
+    snprintf(tmp_path, tmp_len, "%s.tmp", path);
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        free(refs);
+        free(tmp_path);
+        return -1;
+    }
+
+    fwrite(&h, sizeof(h), 1, fp);
+    uint64_t first_entry = 0;
+    for (size_t d = 0; d < num_dirs; d++) {
+        IndexDir dir = *refs[d].dir;
+        dir.path_off += refs[d].strings_base;
+        dir.first_entry = first_entry;
+        first_entry += dir.num_entries;
+        fwrite(&dir, sizeof(dir), 1, fp);
+    }
+    for (size_t d = 0; d < num_dirs; d++) {
+        for (uint32_t i = 0; i < refs[d].dir->num_entries; i++) {
+            IndexEntry e = refs[d].entries[i];
+            e.name_off += refs[d].strings_base;
+            fwrite(&e, sizeof(e), 1, fp);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        fwrite(builders[i].strings, 1, builders[i].strings_size, fp);
+    }
+    free(refs);
+
+    int saved_errno = 0;
+    if (ferror(fp)) {
+        saved_errno = errno ? errno : EIO;
+    }
+    if (fclose(fp) != 0 && saved_errno == 0) {
+        saved_errno = errno;
+    }
+    if (saved_errno == 0 && rename(tmp_path, path) != 0) {
+        saved_errno = errno;
+    }
+    if (saved_errno != 0) {
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+    errno = saved_errno;
+    return saved_errno == 0 ? 0 : -1;
+}
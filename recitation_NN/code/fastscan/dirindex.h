@@ -0,0 +1,137 @@
+/*******************************************************************************
+ * Name        : dirindex.h
+ * Description : On-disk index of directory entries and their stat results,
+ *               keyed by directory path and checked against the directory's
+ *               st_mtim, so that unchanged directories can be served without
+ *               reading them again.
+ *
+ * File layout (all integers in host byte order, every section 8-byte aligned):
+ *
+ *     IndexHeader                         64 bytes
+ *     IndexDir[num_dirs]                  sorted by path for binary search
+ *     IndexEntry[num_entries]             each directory's entries together
+ *     char strings[strings_size]          '\0'-terminated paths and names
+ *
+ * The file is meant to be mmap()ed and used in place; nothing is parsed.
+ ******************************************************************************/
+#ifndef DIRINDEX_H
+#define DIRINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define DIRINDEX_MAGIC   "FSINDEX"
+#define DIRINDEX_VERSION 1
+
+/*
+ * Stored as mtime_nsec of a directory whose listing cannot be trusted on the
+ * next run, so dirindex_fresh() never matches it (see builder_begin_dir()
+ * and builder_mark_incomplete()).
+ */
+#define DIRINDEX_RACY_NSEC UINT32_MAX
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;    /* 0x01020304 as written by the creating host */
+    uint64_t num_dirs;
+    uint64_t num_entries;
+    uint64_t dirs_off;
+    uint64_t entries_off;
+    uint64_t strings_off;
+    uint64_t strings_size;
+} IndexHeader;
+
+typedef struct {
+    uint64_t path_off;      /* into the string table */
+    uint64_t first_entry;
+    uint64_t ino;
+    int64_t  mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t num_entries;
+} IndexDir;
+
+typedef struct {
+    uint64_t name_off;      /* into the string table */
+    uint64_t size;
+    int64_t  mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+} IndexEntry;
+
+/* A read-only, mmap()ed index from a previous scan. */
+typedef struct {
+    void *map;
+    size_t map_size;
+    const IndexHeader *header;
+    const IndexDir *dirs;
+    const IndexEntry *entries;
+    const char *strings;
+} DirIndex;
+
+/*
+ * The part of a new index collected by one thread. Offsets in the records are
+ * local to this builder until dirindex_write() merges the builders.
+ */
+typedef struct {
+    IndexDir *dirs;
+    size_t num_dirs, dirs_cap;
+    IndexEntry *entries;
+    size_t num_entries, entries_cap;
+    char *strings;
+    size_t strings_size, strings_cap;
+} IndexBuilder;
+
+/**
+ * Maps the index at path. Returns 0 on success. Returns -1 and leaves idx empty
+ * (so every lookup misses) if the file is missing or not a valid index.
+ */
+int dirindex_open(DirIndex *idx, const char *path);
+void dirindex_close(DirIndex *idx);
+
+/**
+ * Returns the record for the directory at path, or NULL if it is not indexed.
+ */
+const IndexDir *dirindex_find(const DirIndex *idx, const char *path);
+
+/**
+ * Returns true if the directory described by st is unchanged since dir was
+ * recorded.
+ */
+bool dirindex_fresh(const IndexDir *dir, const struct stat *st);
+
+static inline const char *dirindex_string(const DirIndex *idx, uint64_t off) {
+    return idx->strings + off;
+}
+
+/**
+ * Starts the record for the directory at path. Set racy if the directory was
+ * modified at or after the scan started. It may then change again within the
+ * same timestamp tick after it was read, leaving its st_mtim unchanged. Its
+ * record is kept but marked so the next run reads it again.
+ */
+void builder_begin_dir(IndexBuilder *b, const char *path,
+                       const struct stat *st, bool racy);
+void builder_add_entry(IndexBuilder *b, const char *name,
+                       const struct stat *st);
+
+/**
+ * Marks the directory begun last as read only in part, e.g. because an entry
+ * could not be stat()ed. Like a racy one, it is read again on the next run.
+ */
+void builder_mark_incomplete(IndexBuilder *b);
+void builder_copy_entry(IndexBuilder *b, const DirIndex *idx,
+                        const IndexEntry *entry);
+void builder_free(IndexBuilder *b);
+
+/**
+ * Merges the builders into a single index and atomically replaces the file at
+ * path with it. Returns 0 on success and -1 with errno set on failure.
+ */
+int dirindex_write(const char *path, IndexBuilder *builders, int count);
+
+#endif
@@ -0,0 +1,593 @@
+/*******************************************************************************
+ * Name        : fastscan.c
+ * Description : Recursively lists the files under a directory along with
+ *               their permission strings, like the permstat exercise.
+ *               Instead of opendir()/readdir()/stat() on full path strings,
+ *               it reads directory entries in large getdents64 batches, uses
+ *               d_type to skip stat() calls that are not needed, and calls
+ *               fstatat() relative to an open directory file descriptor.
+ *               Subdirectories are handed out to a pool of worker threads
+ *               that steal work from each other when they run dry.
+ *               With -i, the entries and stat results of every directory are
+ *               saved to an index file, and directories whose mtime has not
+ *               changed since the last run are served from that index.
+ ******************************************************************************/
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "dirindex.h"
+
+#define DENTS_BUFSIZE (1 << 20) /* 1 MiB of directory entries per syscall */
+#define OUT_BUFSIZE   65536
+#define MAX_THREADS   256
+#define FD_BUDGET     256       /* directory fds allowed to sit in queues */
+
+/* The kernel's record layout for getdents64(2); glibc does not export it. */
+struct linux_dirent64 {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+/*
+ * A directory waiting to be scanned. If fd is -1, the directory is opened
+ * through path; otherwise fd was already opened with openat() relative to its
+ * parent and path is only used for printing.
+ */
+typedef struct {
+    char *path;
+    int fd;
+} Task;
+
+/*
+ * Each worker owns a deque of tasks. The owner pushes and pops at the tail
+ * (depth first, which keeps its caches warm), while idle workers steal from
+ * the head, which holds the oldest and usually the largest subtrees.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    Task *items;
+    size_t head, tail, cap;
+} Deque;
+
+typedef struct {
+    char buf[OUT_BUFSIZE];
+    size_t len;
+} OutBuf;
+
+typedef struct {
+    int id;
+    unsigned int seed;
+    char *dents;
+    OutBuf out;
+    unsigned long dirs, entries, stats, cached;
+    IndexBuilder index;
+} Worker;
+
+static struct {
+    bool quiet;
+    char type;           /* 'f', 'd', 'l' or 0 for every type */
+    char *index_file;
+} opts;
+
+static int num_workers;
+static Deque deques[MAX_THREADS];
+static Worker workers[MAX_THREADS];
+static DirIndex old_index;
+static time_t scan_start;   /* whole seconds, see scan_dir() */
+
+static atomic_long pending;      /* tasks queued or being processed */
+static atomic_int queued_fds;
+static atomic_int sleepers;
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Fills perms with the 10-character permission string for mode, e.g.
+ * "drwxr-x---", followed by a '\0'.
+ */
+void perm_string(mode_t mode, char *perms) {
+    static const mode_t bits[] = { S_IRUSR, S_IWUSR, S_IXUSR,
+                                   S_IRGRP, S_IWGRP, S_IXGRP,
+                                   S_IROTH, S_IWOTH, S_IXOTH };
+    static const char letters[] = "rwxrwxrwx";
+
+    if (S_ISDIR(mode))       perms[0] = 'd';
+    else if (S_ISLNK(mode))  perms[0] = 'l';
+    else if (S_ISCHR(mode))  perms[0] = 'c';
+    else if (S_ISBLK(mode))  perms[0] = 'b';
+    else if (S_ISFIFO(mode)) perms[0] = 'p';
+    else if (S_ISSOCK(mode)) perms[0] = 's';
+    else                     perms[0] = '-';
+
+    for (int i = 0; i < 9; i++) {
+        perms[i + 1] = (mode & bits[i]) ? letters[i] : '-';
+    }
+    perms[10] = '\0';
+}
+
+/**
+ * Maps a d_type value to the letter used by the -t option.
+ */
+char dtype_letter(unsigned char d_type) {
+    switch (d_type) {
+        case DT_REG: return 'f';
+        case DT_DIR: return 'd';
+        case DT_LNK: return 'l';
+        default:     return '?';
+    }
+}
+
+char mode_letter(mode_t mode) {
+    if (S_ISREG(mode)) return 'f';
+    if (S_ISDIR(mode)) return 'd';
+    if (S_ISLNK(mode)) return 'l';
+    return '?';
+}
+
+void out_flush(OutBuf *out) {
+    if (out->len == 0) {
+        return;
+    }
+    /* Hold the lock so lines from different workers never interleave. */
+    pthread_mutex_lock(&out_lock);
+    size_t done = 0;
+    while (done < out->len) {
+        ssize_t n = write(STDOUT_FILENO, out->buf + done, out->len - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        done += n;
+    }
+    pthread_mutex_unlock(&out_lock);
+    out->len = 0;
+}
+
+/**
+ * Returns 1 if a '/' is needed between dir and a name inside it, which is
+ * always except when dir is the root "/".
+ */
+size_t separator_len(const char *dir, size_t dlen) {
+    return dlen == 0 || dir[dlen - 1] != '/';
+}
+
+void out_line(OutBuf *out, const char *perms, const char *dir,
+              const char *name) {
+    size_t dlen = strlen(dir), nlen = strlen(name);
+    size_t sep = separator_len(dir, dlen);
+    size_t need = 11 + dlen + sep + nlen + 1;
+    if (out->len + need > OUT_BUFSIZE) {
+        out_flush(out);
+        if (need > OUT_BUFSIZE) {
+            return;
+        }
+    }
+    char *p = out->buf + out->len;
+    memcpy(p, perms, 10);
+    p[10] = ' ';
+    p += 11;
+    memcpy(p, dir, dlen);
+    p += dlen;
+    if (sep) {
+        *p++ = '/';
+    }
+    memcpy(p, name, nlen);
+    p += nlen;
+    *p++ = '\n';
+    out->len += need;
+}
+
+void deque_push(Deque *dq, Task task) {
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail == dq->cap) {
+        if (dq->head > 0) {
+            memmove(dq->items, dq->items + dq->head,
+                    (dq->tail - dq->head) * sizeof(Task));
+            dq->tail -= dq->head;
+            dq->head = 0;
+        } else {
+            size_t cap = dq->cap ? dq->cap * 2 : 64;
+            Task *items = realloc(dq->items, cap * sizeof(Task));
+            if (items == NULL) {
+                pthread_mutex_unlock(&dq->lock);
+                fprintf(stderr, "Error: malloc failed. %s.\n",
+                        strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            dq->items = items;
+            dq->cap = cap;
+        }
+    }
+    dq->items[dq->tail++] = task;
+    pthread_mutex_unlock(&dq->lock);
+}
+
+bool deque_pop_tail(Deque *dq, Task *task) {
+    bool found = false;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail > dq->head) {
+        *task = dq->items[--dq->tail];
+        found = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+bool deque_steal_head(Deque *dq, Task *task) {
+    bool found = false;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail > dq->head) {
+        *task = dq->items[dq->head++];
+        found = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+/**
+ * Queues a directory on the given worker's deque and wakes a sleeping worker,
+ * if there is one, so it can steal it.
+ */
+void submit(Worker *w, Task task) {
+    atomic_fetch_add(&pending, 1);
+    deque_push(&deques[w->id], task);
+    if (atomic_load(&sleepers) > 0) {
+        pthread_mutex_lock(&idle_lock);
+        pthread_cond_signal(&idle_cond);
+        pthread_mutex_unlock(&idle_lock);
+    }
+}
+
+bool find_work(Worker *w, Task *task) {
+    if (deque_pop_tail(&deques[w->id], task)) {
+        return true;
+    }
+    int start = rand_r(&w->seed) % num_workers;
+    for (int i = 0; i < num_workers; i++) {
+        int victim = (start + i) % num_workers;
+        if (victim != w->id && deque_steal_head(&deques[victim], task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+char *join_path(const char *dir, const char *name) {
+    size_t dlen = strlen(dir), nlen = strlen(name);
+    size_t sep = separator_len(dir, dlen);
+    char *path = malloc(dlen + sep + nlen + 1);
+    if (path == NULL) {
+        fprintf(stderr, "Error: malloc failed. %s.\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    memcpy(path, dir, dlen);
+    if (sep) {
+        path[dlen] = '/';
+    }
+    memcpy(path + dlen + sep, name, nlen + 1);
+    return path;
+}
+
+/**
+ * Queues the subdirectory name of the directory open on dfd. While the fd
+ * budget allows it, the subdirectory is opened right away with openat() so
+ * that the kernel does not have to walk the full path again later.
+ */
+void submit_subdir(Worker *w, int dfd, const char *dir, const char *name) {
+    Task task = { join_path(dir, name), -1 };
+    if (atomic_fetch_add(&queued_fds, 1) < FD_BUDGET) {
+        task.fd = openat(dfd, name,
+                         O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+    if (task.fd < 0) {
+        atomic_fetch_sub(&queued_fds, 1);
+    }
+    submit(w, task);
+}
+
+/**
+ * Replays the entries of an unchanged directory from the old index, copying
+ * them into the new one. Subdirectories are still queued, because their own
+ * contents may have changed even though this directory did not.
+ */
+void replay_dir(Worker *w, int dfd, const char *path, const IndexDir *dir) {
+    const IndexEntry *entries = old_index.entries + dir->first_entry;
+    w->cached++;
+    for (uint32_t i = 0; i < dir->num_entries; i++) {
+        const char *name = dirindex_string(&old_index, entries[i].name_off);
+        builder_copy_entry(&w->index, &old_index, &entries[i]);
+        w->entries++;
+
+        char type = mode_letter(entries[i].mode);
+        if (!opts.quiet && (!opts.type || opts.type == type)) {
+            char perms[11];
+            perm_string(entries[i].mode, perms);
+            out_line(&w->out, perms, path, name);
+        }
+        if (type == 'd') {
+            submit_subdir(w, dfd, path, name);
+        }
+    }
+}
+
+void scan_dir(Worker *w, Task task) {
+    int dfd = task.fd;
+    if (dfd >= 0) {
+        atomic_fetch_sub(&queued_fds, 1);
+    } else {
+        dfd = open(task.path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+    if (dfd < 0) {
+        fprintf(stderr, "Error: Cannot open directory '%s'. %s.\n",
+                task.path, strerror(errno));
+        free(task.path);
+        return;
+    }
+    w->dirs++;
+
+    /* One fstat() of the directory decides whether it needs reading at all. */
+    bool indexing = false;
+    if (opts.index_file) {
+        struct stat dst;
+        if (fstat(dfd, &dst) == 0) {
+            const IndexDir *old = dirindex_find(&old_index, task.path);
+            /* Compared in whole seconds so that it also holds on file
+             * systems with coarser timestamps than the clock. */
+            bool racy = dst.st_mtim.tv_sec >= scan_start;
+            builder_begin_dir(&w->index, task.path, &dst, racy);
+            if (old != NULL && dirindex_fresh(old, &dst)) {
+                replay_dir(w, dfd, task.path, old);
+                close(dfd);
+                free(task.path);
+                return;
+            }
+            indexing = true;
+        }
+    }
+
+    /* Cleared if any entry could not be read, so that the partial listing is
+     * never served from the index. */
+    bool complete = true;
+    long nread;
+    while ((nread = syscall(SYS_getdents64, dfd, w->dents,
+                            DENTS_BUFSIZE)) > 0) {
+        for (long pos = 0; pos < nread; ) {
+            struct linux_dirent64 *d =
+                (struct linux_dirent64 *)(w->dents + pos);
+            pos += d->d_reclen;
+
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' ||
+                                   (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            w->entries++;
+
+            char type = dtype_letter(d->d_type);
+            bool wanted = !opts.type || opts.type == type;
+            bool need_stat = d->d_type == DT_UNKNOWN || indexing ||
+                             (!opts.quiet && wanted);
+
+            struct stat st;
+            if (need_stat) {
+                w->stats++;
+                if (fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+                    fprintf(stderr, "Error: Cannot stat '%s/%s'. %s.\n",
+                            task.path, name, strerror(errno));
+                    complete = false;
+                    continue;
+                }
+                type = mode_letter(st.st_mode);
+                wanted = !opts.type || opts.type == type;
+                if (indexing) {
+                    builder_add_entry(&w->index, name, &st);
+                }
+            }
+            if (wanted && !opts.quiet) {
+                char perms[11];
+                perm_string(st.st_mode, perms);
+                out_line(&w->out, perms, task.path, name);
+            }
+            if (type == 'd') {
+                submit_subdir(w, dfd, task.path, name);
+            }
+        }
+    }
+    if (nread < 0) {
+        fprintf(stderr, "Error: Cannot read directory '%s'. %s.\n",
+                task.path, strerror(errno));
+        complete = false;
+    }
+    if (indexing && !complete) {
+        builder_mark_incomplete(&w->index);
+    }
+    close(dfd);
+    free(task.path);
+}
+
+void *worker_main(void *arg) {
+    Worker *w = arg;
+    Task task;
+
+    while (true) {
+        if (find_work(w, &task)) {
+            scan_dir(w, task);
+            if (atomic_fetch_sub(&pending, 1) == 1) {
+                pthread_mutex_lock(&idle_lock);
+                pthread_cond_broadcast(&idle_cond);
+                pthread_mutex_unlock(&idle_lock);
+            }
+            continue;
+        }
+        if (atomic_load(&pending) == 0) {
+            break;
+        }
+        /* The timeout covers a submit() racing with us going to sleep. */
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock(&idle_lock);
+        atomic_fetch_add(&sleepers, 1);
+        if (atomic_load(&pending) > 0) {
+            pthread_cond_timedwait(&idle_cond, &idle_lock, &deadline);
+        }
+        atomic_fetch_sub(&sleepers, 1);
+        pthread_mutex_unlock(&idle_lock);
+    }
+    out_flush(&w->out);
+    return NULL;
+}
+
+void display_usage(char *progname) {
+    fprintf(stderr, "Usage: %s [-j threads] [-t f|d|l] [-i index] [-q] "
+            "<directory>\n", progname);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+    num_workers = nprocs > 0 ? (int)nprocs : 1;
+    opterr = 0;
+
+    while ((opt = getopt(argc, argv, ":j:t:i:q")) != -1) {
+        switch (opt) {
+            case 'j':
+                num_workers = atoi(optarg);
+                if (num_workers < 1 || num_workers > MAX_THREADS) {
+                    fprintf(stderr, "Error: Thread count must be between 1 "
+                            "and %d.\n", MAX_THREADS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 't':
+                if (strlen(optarg) != 1 || !strchr("fdl", optarg[0])) {
+                    fprintf(stderr, "Error: Unknown type '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                opts.type = optarg[0];
+                break;
+            case 'i':
+                opts.index_file = optarg;
+                break;
+            case 'q':
+                opts.quiet = true;
+                break;
+            case ':':
+                fprintf(stderr, "Error: Option '-%c' requires an argument.\n",
+                        optopt);
+                display_usage(argv[0]);
+                return EXIT_FAILURE;
+            default:
+                fprintf(stderr, "Error: Unknown option '-%c' received.\n",
+                        optopt);
+                display_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind + 1 != argc) {
+        display_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* Trim trailing slashes so printed paths do not contain "//". The root
+     * "/" keeps its slash, and join_path() and out_line() add none after
+     * it. */
+    char *root = strdup(argv[optind]);
+    size_t rlen = strlen(root);
+    while (rlen > 1 && root[rlen - 1] == '/') {
+        root[--rlen] = '\0';
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (opts.index_file) {
+        /* File systems stamp mtimes from the coarse clock, which may lag
+         * the precise one. */
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME_COARSE, &now);
+        scan_start = now.tv_sec;
+        /* A missing or unreadable index just means a full scan. */
+        dirindex_open(&old_index, opts.index_file);
+    }
+
+    for (int i = 0; i < num_workers; i++) {
+        pthread_mutex_init(&deques[i].lock, NULL);
+        workers[i].id = i;
+        workers[i].seed = (unsigned int)i * 2654435761u + 1;
+        if ((workers[i].dents = malloc(DENTS_BUFSIZE)) == NULL) {
+            fprintf(stderr, "Error: malloc failed. %s.\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+    submit(&workers[0], (Task){ root, -1 });
+
+    pthread_t threads[MAX_THREADS];
+    for (int i = 1; i < num_workers; i++) {
+        if ((errno = pthread_create(&threads[i], NULL, worker_main,
+                                    &workers[i])) != 0) {
+            fprintf(stderr, "Error: Cannot create thread. %s.\n",
+                    strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+    worker_main(&workers[0]);
+    for (int i = 1; i < num_workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    dirindex_close(&old_index);
+    IndexBuilder builders[MAX_THREADS];
+    for (int i = 0; i < num_workers; i++) {
+        builders[i] = workers[i].index;
+    }
+    if (opts.index_file &&
+        dirindex_write(opts.index_file, builders, num_workers) != 0) {
+        fprintf(stderr, "Error: Cannot write index '%s'. %s.\n",
+                opts.index_file, strerror(errno));
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) +
+                     (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    unsigned long dirs = 0, entries = 0, stats = 0, cached = 0;
+    for (int i = 0; i < num_workers; i++) {
+        dirs += workers[i].dirs;
+        entries += workers[i].entries;
+        stats += workers[i].stats;
+        cached += workers[i].cached;
+        builder_free(&workers[i].index);
+        free(workers[i].dents);
+        free(deques[i].items);
+    }
+    if (opts.quiet) {
+        printf("%lu directories (%lu from index), %lu entries, %lu stat calls, "
+               "%d threads, %.3f s\n", dirs, cached, entries, stats,
+               num_workers, elapsed);
+    }
+    return EXIT_SUCCESS;
+}